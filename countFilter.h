@@ -0,0 +1,92 @@
+/*
+ * countFilter.h
+ *
+ * blocked counting Bloom filter: each kmer adds its counts to filterHashes one-byte
+ * counters in one cache line picked by its hash; counters saturate at 255 instead of
+ * wrapping, so the smallest of a kmer's counters never falls below the true total of
+ * what was added for it and a kmer whose smallest counter is under a threshold below
+ * 256 cannot reach that threshold; counters may be added to from several threads
+ */
+
+#ifndef COUNTFILTER_H_
+#define COUNTFILTER_H_
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include "kmerHash.h"
+
+const int filterHashes = 3; // counters each kmer adds to
+const int filterLineBits = 6; // counters of one kmer share a 64-byte line
+const size_t filterCounters = 8; // counters allotted per distinct kmer expected in the input
+
+class CountFilter
+{
+public:
+	CountFilter ()
+		: _mask(0)
+	{ }
+
+	// init allocates at least ncounters counters (rounded up to a power of two lines), all 0
+	void init (size_t ncounters)
+	{
+		size_t nlines = 1;
+		while ((nlines << filterLineBits) < ncounters)
+			nlines <<= 1;
+		std::vector<uint8_t>(nlines << filterLineBits, 0).swap(_cell);
+		_mask = nlines - 1;
+	}
+
+	void clear ()
+	{
+		std::vector<uint8_t>().swap(_cell);
+		_mask = 0;
+	}
+
+	bool empty () const
+	{
+		return _cell.empty();
+	}
+
+	size_t bytes () const
+	{
+		return _cell.size();
+	}
+
+	// add adds n to the counters of hash h, saturating at 255
+	void add (uint64_t h, unsigned int n)
+	{
+		uint8_t* line = &_cell[(h & _mask) << filterLineBits];
+		uint64_t g = fmix64(h);
+		for (int i = 0; i < filterHashes; ++i, g >>= filterLineBits)
+		{
+			uint8_t* c = line + (g & ((1 << filterLineBits) - 1));
+			uint8_t old = __atomic_load_n(c, __ATOMIC_RELAXED);
+			uint8_t sum = 0;
+			do
+				sum = n < 0xffU - old ? old + n : 0xff;
+			while (sum != old && !__atomic_compare_exchange_n(c, &old, sum, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		}
+	}
+
+	// least returns the smallest counter of hash h, an upper bound on the total added for h
+	unsigned int least (uint64_t h) const
+	{
+		const uint8_t* line = &_cell[(h & _mask) << filterLineBits];
+		uint64_t g = fmix64(h);
+		unsigned int m = 0xff;
+		for (int i = 0; i < filterHashes; ++i, g >>= filterLineBits)
+		{
+			unsigned int c = line[g & ((1 << filterLineBits) - 1)];
+			if (c < m)
+				m = c;
+		}
+		return m;
+	}
+
+private:
+	std::vector<uint8_t> _cell;
+	size_t _mask; // lines - 1
+};
+
+#endif /* COUNTFILTER_H_ */
@@ -0,0 +1,138 @@
+/*
+ * gofKernel.cpp
+ *
+ * every kernel sums counts as unsigned int and adds each row's terms (obs - e)^2 / e,
+ * e = p * total, in library order with the same operations as gofScalar, so they agree
+ * bit for bit; the vector kernels are built without floating-point contraction for the
+ * same reason
+ */
+
+#include "gofKernel.h"
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define GOF_X86 1
+#if defined(__clang__)
+#define GOF_TARGET(isa) __attribute__((target(isa)))
+#else
+#define GOF_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#endif
+#endif
+
+size_t gofScalar (const unsigned int obs [], size_t stride, size_t n, const double p [], unsigned int m, double stat [])
+{
+	size_t nzero = 0;
+	for (size_t r = 0; r < n; ++r)
+	{
+		unsigned int total = 0;
+		unsigned int i = 0;
+		for (i = 0; i < m; ++i)
+			total += obs[i * stride + r];
+		double s = 0.0;
+		for (i = 0; i < m; ++i)
+		{
+			double expt = p[i] * total;
+			if (expt == 0)
+				break;
+			double d = obs[i * stride + r] - expt;
+			s += d * d / expt;
+		}
+		if (i < m)
+		{
+			s = std::numeric_limits<double>::infinity();
+			++nzero;
+		}
+		stat[r] = s;
+	}
+	return nzero;
+}
+
+#ifdef GOF_X86
+// toDouble converts four unsigned ints to doubles exactly
+GOF_TARGET("avx2") static inline __m256d toDouble (__m128i v)
+{
+	const __m128i bias = _mm_set1_epi32(0x80000000);
+	return _mm256_add_pd(_mm256_cvtepi32_pd(_mm_xor_si128(v, bias)), _mm256_set1_pd(2147483648.0));
+}
+
+GOF_TARGET("avx2") static size_t gofAvx2 (const unsigned int obs [], size_t stride, size_t n, const double p [], unsigned int m, double stat [])
+{
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+	size_t nzero = 0;
+	size_t r = 0;
+	unsigned int i = 0;
+	for (; r + 4 <= n; r += 4)
+	{
+		__m128i total = _mm_setzero_si128();
+		for (i = 0; i < m; ++i)
+			total = _mm_add_epi32(total, _mm_loadu_si128(reinterpret_cast<const __m128i*>(obs + i * stride + r)));
+		__m256d t = toDouble(total);
+		__m256d s = zero;
+		__m256d bad = zero;
+		for (i = 0; i < m; ++i)
+		{
+			__m256d expt = _mm256_mul_pd(_mm256_set1_pd(p[i]), t);
+			bad = _mm256_or_pd(bad, _mm256_cmp_pd(expt, zero, _CMP_EQ_OQ));
+			__m256d d = _mm256_sub_pd(toDouble(_mm_loadu_si128(reinterpret_cast<const __m128i*>(obs + i * stride + r))), expt);
+			s = _mm256_add_pd(s, _mm256_div_pd(_mm256_mul_pd(d, d), expt));
+		}
+		_mm256_storeu_pd(stat + r, _mm256_blendv_pd(s, inf, bad));
+		nzero += __builtin_popcount(_mm256_movemask_pd(bad));
+	}
+	return nzero + gofScalar(obs + r, stride, n - r, p, m, stat + r);
+}
+
+GOF_TARGET("avx512f") static size_t gofAvx512 (const unsigned int obs [], size_t stride, size_t n, const double p [], unsigned int m, double stat [])
+{
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d inf = _mm512_set1_pd(std::numeric_limits<double>::infinity());
+	size_t nzero = 0;
+	size_t r = 0;
+	unsigned int i = 0;
+	for (; r + 8 <= n; r += 8)
+	{
+		__m256i total = _mm256_setzero_si256();
+		for (i = 0; i < m; ++i)
+			total = _mm256_add_epi32(total, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(obs + i * stride + r)));
+		__m512d t = _mm512_maskz_cvtepu32_pd(0xff, total);
+		__m512d s = zero;
+		__mmask8 bad = 0;
+		for (i = 0; i < m; ++i)
+		{
+			__m512d expt = _mm512_mul_pd(_mm512_set1_pd(p[i]), t);
+			bad |= _mm512_cmp_pd_mask(expt, zero, _CMP_EQ_OQ);
+			__m512d d = _mm512_sub_pd(_mm512_maskz_cvtepu32_pd(0xff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(obs + i * stride + r))), expt);
+			s = _mm512_add_pd(s, _mm512_div_pd(_mm512_mul_pd(d, d), expt));
+		}
+		_mm512_storeu_pd(stat + r, _mm512_mask_blend_pd(bad, s, inf));
+		nzero += __builtin_popcount(bad);
+	}
+	return nzero + gofScalar(obs + r, stride, n - r, p, m, stat + r);
+}
+#endif
+
+// gofKernel returns the widest kernel the running CPU supports
+GofKernel gofKernel ()
+{
+#ifdef GOF_X86
+	if (__builtin_cpu_supports("avx512f"))
+		return gofAvx512;
+	if (__builtin_cpu_supports("avx2"))
+		return gofAvx2;
+#endif
+	return gofScalar;
+}
+
+const char* gofKernelName ()
+{
+	GofKernel k = gofKernel();
+#ifdef GOF_X86
+	if (k == gofAvx512)
+		return "avx512";
+	if (k == gofAvx2)
+		return "avx2";
+#endif
+	return k == gofScalar ? "scalar" : "unknown";
+}
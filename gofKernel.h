@@ -0,0 +1,25 @@
+/*
+ * gofKernel.h
+ *
+ * goodness-of-fit statistics for a batch of kmers at once; counts are given
+ * library-major (all kmers' counts for one library, then the next) so the
+ * vector kernels read them with plain loads
+ */
+
+#ifndef GOFKERNEL_H_
+#define GOFKERNEL_H_
+
+#include <cstddef>
+
+const size_t gofBatch = 1024; // kmers scored per kernel call
+
+// GofKernel sets stat[r] for rows r < n to the weighted goodness-of-fit of counts obs[i * stride + r] over m libraries
+// whose expected shares are p[i]; a row whose expected count is 0 in any library gets infinity, and the number of
+// such rows is returned
+typedef size_t (*GofKernel) (const unsigned int obs [], size_t stride, size_t n, const double p [], unsigned int m, double stat []);
+
+size_t gofScalar (const unsigned int obs [], size_t stride, size_t n, const double p [], unsigned int m, double stat []);
+GofKernel gofKernel ();
+const char* gofKernelName ();
+
+#endif /* GOFKERNEL_H_ */
@@ -0,0 +1,70 @@
+/*
+ * hyperLogLog.h
+ *
+ * HyperLogLog sketch of the number of distinct values in a stream of 64-bit hashes
+ * (Flajolet et al. 2007); sketches built on separate threads merge into one for the union
+ */
+
+#ifndef HYPERLOGLOG_H_
+#define HYPERLOGLOG_H_
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+const int sketchBits = 16; // 2^16 one-byte registers, for a standard error of about 0.4%
+
+class HyperLogLog
+{
+public:
+	HyperLogLog ()
+		: _reg(static_cast<size_t>(1) << sketchBits, 0)
+	{ }
+
+	// add records one hash; the top sketchBits bits pick a register, which keeps the longest run of leading zeros seen below them
+	void add (uint64_t h)
+	{
+		uint64_t rest = (h << sketchBits) | (static_cast<uint64_t>(1) << (sketchBits - 1));
+		uint8_t rank = __builtin_clzll(rest) + 1;
+		uint8_t& r = _reg[h >> (64 - sketchBits)];
+		if (rank > r)
+			r = rank;
+	}
+
+	// merge makes this the sketch of the union of both streams
+	void merge (const HyperLogLog& other)
+	{
+		for (size_t i = 0; i < _reg.size(); ++i)
+			if (other._reg[i] > _reg[i])
+				_reg[i] = other._reg[i];
+	}
+
+	// estimate returns the approximate number of distinct hashes added, using linear counting while registers are still empty
+	double estimate () const
+	{
+		double m = _reg.size();
+		double sum = 0.0;
+		size_t zeros = 0;
+		for (size_t i = 0; i < _reg.size(); ++i)
+		{
+			sum += ldexp(1.0, -_reg[i]);
+			zeros += _reg[i] == 0;
+		}
+		double e = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+		if (e <= 2.5 * m && zeros > 0)
+			e = m * log(m / zeros);
+		return e;
+	}
+
+	// relativeError is the standard error of estimate as a fraction of the true count
+	double relativeError () const
+	{
+		return 1.04 / sqrt(static_cast<double>(_reg.size()));
+	}
+
+private:
+	std::vector<uint8_t> _reg;
+};
+
+#endif /* HYPERLOGLOG_H_ */
@@ -0,0 +1,232 @@
+/*
+ * jellyReader.cpp
+ */
+
+#include "jellyReader.h"
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const size_t readBlock = 1 << 26; // bytes per read() when the input cannot be mapped
+
+JellyReader::JellyReader ()
+	: _fd(-1),
+	  _data(0),
+	  _len(0),
+	  _pos(0),
+	  _end(0),
+	  _bufsz(0),
+	  _mapped(false),
+	  _eof(false),
+	  _bad(false)
+{ }
+
+JellyReader::~JellyReader ()
+{
+	close();
+}
+
+// open maps fname into memory, falling back to block reads if it cannot be mapped
+bool JellyReader::open (const char* fname)
+{
+	close();
+	_fd = ::open(fname, O_RDONLY);
+	if (_fd < 0)
+		return false;
+	struct stat sb;
+	if (fstat(_fd, &sb) == 0 && S_ISREG(sb.st_mode))
+	{
+		_len = sb.st_size;
+		if (_len == 0)
+		{
+			_eof = true;
+			return true;
+		}
+		void* addr = mmap(0, _len, PROT_READ, MAP_PRIVATE, _fd, 0);
+		if (addr != MAP_FAILED)
+		{
+			madvise(addr, _len, MADV_SEQUENTIAL);
+			_data = static_cast<char*>(addr);
+			_pos = _data;
+			_end = _data + _len;
+			_mapped = true;
+			_eof = true;
+			return true;
+		}
+	}
+	_bufsz = readBlock;
+	_data = new char[_bufsz];
+	_pos = _data;
+	_end = _data;
+	return true;
+}
+
+// setRange limits a mapped file to the lines that start within bytes [begin, end), so several readers can split one file
+bool JellyReader::setRange (size_t begin, size_t end)
+{
+	if (!_mapped)
+		return false;
+	if (end > _len)
+		end = _len;
+	const char* nl = 0;
+	_pos = _data + _len;
+	if (begin == 0)
+		_pos = _data;
+	else if (begin < _len && (nl = static_cast<const char*>(memchr(_data + begin - 1, '\n', _len - begin + 1))))
+		_pos = nl + 1;
+	_end = _data + _len;
+	if (end == 0)
+		_end = _data;
+	else if (end < _len && (nl = static_cast<const char*>(memchr(_data + end - 1, '\n', _len - end + 1))))
+		_end = nl + 1;
+	if (_pos > _end)
+		_pos = _end;
+	return true;
+}
+
+void JellyReader::close ()
+{
+	if (_mapped)
+		munmap(_data, _len);
+	else
+		delete [] _data;
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+	_data = 0;
+	_len = 0;
+	_pos = 0;
+	_end = 0;
+	_bufsz = 0;
+	_mapped = false;
+	_eof = false;
+	_bad = false;
+}
+
+// next returns the kmer and count on the next non-empty line, false at end of input, on a malformed line, or on a read error
+bool JellyReader::next (const char*& seq, int& seqlen, unsigned long int& count)
+{
+	const char* line = 0;
+	const char* lineend = 0;
+	const char* c = 0;
+	do
+	{
+		if (!nextLine(line, lineend))
+			return false;
+		while (line < lineend && (*line == ' ' || *line == '\t'))
+			++line;
+	} while (line == lineend || *line == '\r');
+
+	seq = line;
+	c = line;
+	while (c < lineend && *c != ' ' && *c != '\t')
+		++c;
+	seqlen = c - line;
+	while (c < lineend && (*c == ' ' || *c == '\t'))
+		++c;
+	if (c == lineend || *c < '0' || *c > '9')
+	{
+		fprintf(stderr, "Malformed Jellyfish line: %.*s\n", static_cast<int>(lineend - line), line);
+		_bad = true;
+		return false;
+	}
+	count = 0;
+	while (c < lineend && *c >= '0' && *c <= '9')
+		count = count * 10 + (*c++ - '0');
+	return true;
+}
+
+// merLength returns the length of the first kmer without consuming it, -1 if there is none
+int JellyReader::merLength ()
+{
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	if (!next(seq, seqlen, count))
+		return -1;
+	_pos = seq; // the first record is still in the buffer, so rewind to it
+	return seqlen;
+}
+
+size_t JellyReader::fileSize () const
+{
+	return _len;
+}
+
+bool JellyReader::mapped () const
+{
+	return _mapped;
+}
+
+bool JellyReader::bad () const
+{
+	return _bad;
+}
+
+// nextLine finds the bounds of the next line with memchr, refilling the read buffer as needed
+bool JellyReader::nextLine (const char*& line, const char*& lineend)
+{
+	const char* nl = 0;
+	while (true)
+	{
+		nl = static_cast<const char*>(memchr(_pos, '\n', _end - _pos));
+		if (nl)
+		{
+			line = _pos;
+			lineend = nl;
+			_pos = nl + 1;
+			return true;
+		}
+		if (_eof)
+		{
+			if (_pos == _end)
+				return false;
+			line = _pos; // final line without a newline
+			lineend = _end;
+			_pos = _end;
+			return true;
+		}
+		if (!refill())
+		{
+			if (_bad)
+				return false;
+			_eof = true;
+		}
+	}
+}
+
+// refill moves the partial line to the front of the read buffer and reads the next block behind it
+bool JellyReader::refill ()
+{
+	size_t carry = _end - _pos;
+	if (carry == _bufsz)
+	{
+		char* bigger = new char[_bufsz * 2];
+		memcpy(bigger, _pos, carry);
+		delete [] _data;
+		_data = bigger;
+		_bufsz *= 2;
+	}
+	else
+		memmove(_data, _pos, carry);
+	_pos = _data;
+	_end = _data + carry;
+	ssize_t nread = 0;
+	do
+	{
+		nread = read(_fd, _data + carry, _bufsz - carry);
+	} while (nread < 0 && errno == EINTR);
+	if (nread < 0)
+	{
+		fprintf(stderr, "Could not read Jellyfish input: %s\n", strerror(errno));
+		_bad = true;
+	}
+	if (nread <= 0)
+		return false;
+	_end += nread;
+	return true;
+}
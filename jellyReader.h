@@ -0,0 +1,43 @@
+/*
+ * jellyReader.h
+ *
+ * zero-copy reader for Jellyfish text dumps ("<kmer> <count>" per line)
+ * regular files are memory mapped; anything that cannot be mapped (pipes, FIFOs)
+ * is read in large blocks; records are returned as views into the buffer
+ */
+
+#ifndef JELLYREADER_H_
+#define JELLYREADER_H_
+
+#include <cstddef>
+
+class JellyReader
+{
+public:
+	JellyReader ();
+	~JellyReader ();
+	bool open (const char* fname);
+	bool setRange (size_t begin, size_t end);
+	void close ();
+	bool next (const char*& seq, int& seqlen, unsigned long int& count);
+	int merLength ();
+	size_t fileSize () const;
+	bool mapped () const;
+	bool bad () const;
+private:
+	// private variables
+	int _fd;
+	char* _data; // start of the mapped file or the read buffer
+	size_t _len; // size of the file (0 if unknown)
+	const char* _pos; // next unread byte
+	const char* _end; // end of valid data in _data
+	size_t _bufsz; // capacity of the read buffer
+	bool _mapped;
+	bool _eof; // no more data to read into the buffer
+	bool _bad; // a malformed line or a read error stopped reading
+	//private functions
+	bool refill ();
+	bool nextLine (const char*& line, const char*& lineend);
+};
+
+#endif /* JELLYREADER_H_ */
@@ -3,253 +3,1933 @@
  */
 
 #include <cstdio>
-#include <limits>
 #include <math.h>
 #include <algorithm>
+#include <limits>
 #include "kmer.h"
 #include "parseData.h"
 #include <iostream>
+#include <thread>
+#include <sys/stat.h>
 
 kmer::kmer ()
 	: fail(0),
-	  stat(0),
-	  statsize(0),
+	  tablebytes(0),
+	  mincount(0),
+	  minlibs(0),
+	  pvalues(false),
+	  top(0),
+	  minstat(-std::numeric_limits<double>::infinity()),
+	  canonical(false),
+	  sparse(-1),
 	  nonseq_char(3),
 	  xtra_reserve(0.50),
 	  nlibs(0),
 	  kmertypes(0),
-	  storage(0)
+	  storage(0),
+	  presized(false),
+	  merlen(0),
+	  indexfiltered(false),
+	  ntargets(0),
+	  nskipped(0)
 {
 
 }
 
 kmer::~kmer ()
 {
-	if (stat != 0)
-		clearStat();
+
+}
+
+// parseJellyCounts extracts kmers and counts from Jellyfish files (sets member "counts")
+void kmer::parseJellyCounts (std::vector<std::string>& files)
+{
+	if ( files.empty() )
+	{
+		fprintf(stderr, "No files to parse in call to kmer::parseJellyCounts\n");
+		fail = 1;
+		return;
+	}
+	unsigned int lib = 0;
+	unsigned long int filelen = 0;
+	JellyReader reader;
+	for (std::vector<std::string>::iterator fIter = files.begin(); fIter != files.end(); ++fIter)
+	{
+		std::cerr << "reading file: " << *fIter << "\n";
+		if (!reader.open(fIter->c_str()))
+		{
+				std::cerr << "Could not open file: " << *fIter << "\n";
+				fail = 1;
+				return;
+		}
+		int filemer = jellyMerLength(reader);
+		if (filemer < 0)
+		{
+			std::cerr << (reader.bad() ? "Could not read file: " : "0 sequences found in file: ") << *fIter << "\n";
+			fail = 1;
+			return;
+		}
+		fprintf(stderr, "kmer length is %d\n", filemer);
+		if (lib == 0)
+		{
+			if (filemer < 1 || filemer > maxMerLength)
+			{
+				fprintf(stderr, "kmer length must be between 1 and %d (rebuild with a larger KMER_WORDS for longer kmers)\n", maxMerLength);
+				fail = 1;
+				return;
+			}
+			merlen = filemer;
+			libtotal.setSize(files.size());
+			if (!presized)
+			{
+				filelen = estLines (reader.fileSize(), merlen, nonseq_char);
+				storage = targetCap(filelen + filelen * xtra_reserve);
+			}
+			datamap.init(files.size(), storage, 0, 0, countBytes(files));
+		}
+		else if (filemer != merlen)
+		{
+			fprintf(stderr, "kmer length %d in %s differs from length %d in the first file\n", filemer, fIter->c_str(), merlen);
+			fail = 1;
+			return;
+		}
+		if (!readLibrary(reader, lib))
+			return;
+		reader.close();
+		++lib;
+	}
+
+	/* start debug code
+	for(countmap::const_iterator it = datamap.begin(); it != datamap.end(); ++it)
+	{
+		std::cerr << numtoseq(it.key()) << "\t";
+		for (unsigned int j = 0; j < datamap.nlibs(); ++j)
+		{
+			std::cerr << "\t" << it.count(j);
+		}
+		std::cerr << "\n";
+	}
+	 end debug code */
+	reportSkipped();
+}
+// readLibrary adds the kmers and counts of an open Jellyfish file to the table as library lib
+bool kmer::readLibrary (JellyReader& reader, unsigned int lib)
+{
+	unsigned long int count = 0;
+	Key seqID;
+	const char* seq = 0;
+	int seqlen = 0;
+	bool added = false;
+	while (reader.next(seq, seqlen, count))
+	{
+		if (seqlen != merlen)
+		{
+			fprintf(stderr, "kmer %.*s does not have length %d\n", seqlen, seq, merlen);
+			fail = 1;
+			return false;
+		}
+		if (!seqtonum(seq, seqID))
+			continue;
+		libtotal[lib] += count;
+		if (!mayPass(seqID))
+			continue;
+		putCount(seqID, lib, count, added);
+		if (added)
+			++kmertypes;
+	}
+	if (reader.bad())
+	{
+		fail = 1;
+		return false;
+	}
+	return true;
+}
+
+// appendLibraries adds the libraries in files after those of a table taken up with loadIndex; the table is copied once
+// into rows wide enough for them, every kmer keeping its slot if the capacity need not grow, and then only the new files
+// are parsed, their new kmers counting zero in the earlier libraries; an index built with -min-count, -min-libs, or
+// -targets is refused, as the kmers it dropped would read as zero in its libraries too
+void kmer::appendLibraries (std::vector<std::string>& files)
+{
+	if (indexfiltered)
+	{
+		fprintf(stderr, "Cannot append libraries to an index built with -min-count, -min-libs, or -targets: the kmers it dropped\n"
+			"have no counts in its libraries (rebuild the index without them, and filter the appended run instead)\n");
+		fail = 1;
+		return;
+	}
+	unsigned int first = libtotal.size();
+	unsigned int lib = 0;
+	JellyReader reader;
+	std::vector<size_t> totals(first);
+	for (lib = 0; lib < first; ++lib)
+		totals[lib] = libtotal[lib];
+	libtotal.setSize(first + files.size());
+	for (lib = 0; lib < first; ++lib)
+		libtotal[lib] = totals[lib];
+
+	std::cerr << "Appending " << files.size() << " libraries to the " << first << " of the index\n";
+	{
+		countmap wider;
+		wider.widen(datamap, first + files.size(), datamap.size() + (presized ? storage : estimateKmers(files)));
+		datamap.swap(wider);
+	}
+	indexmap.close();
+	nlibs = libtotal.size();
+	kmertypes = datamap.size();
+
+	for (lib = first; lib < libtotal.size(); ++lib)
+	{
+		const std::string& file = files[lib - first];
+		std::cerr << "reading file: " << file << "\n";
+		if (!reader.open(file.c_str()))
+		{
+			std::cerr << "Could not open file: " << file << "\n";
+			fail = 1;
+			return;
+		}
+		int filemer = jellyMerLength(reader);
+		if (filemer < 0)
+		{
+			std::cerr << (reader.bad() ? "Could not read file: " : "0 sequences found in file: ") << file << "\n";
+			fail = 1;
+			return;
+		}
+		if (filemer != merlen)
+		{
+			fprintf(stderr, "kmer length %d in %s differs from length %d in the index\n", filemer, file.c_str(), merlen);
+			fail = 1;
+			return;
+		}
+		if (!readLibrary(reader, lib))
+			return;
+		reader.close();
+		// each count set in a sparse row rewrote the whole row at the end of the pairs
+		datamap.compactPairs();
+	}
+	reportSkipped();
+}
+
+// loadTargets reads a panel of kmers, the first word of each line of fname, as the only kmers to load from files;
+// the panel must have the kmer length of the files, and kmers off it are turned away as they are read, so that
+// the table is sized for the panel rather than the input
+bool kmer::loadTargets (const std::string& fname, const std::vector<std::string>& files)
+{
+	JellyReader reader;
+	if (files.empty() || !reader.open(files[0].c_str()))
+	{
+		std::cerr << "Could not open file: " << (files.empty() ? std::string() : files[0]) << "\n";
+		fail = 1;
+		return false;
+	}
+	int filemer = jellyMerLength(reader);
+	reader.close();
+	if (filemer < 1 || filemer > maxMerLength)
+	{
+		std::cerr << "Could not read the kmer length of file: " << files[0] << "\n";
+		fail = 1;
+		return false;
+	}
+	merlen = filemer;
+
+	std::ifstream is(fname.c_str());
+	if (is.fail())
+	{
+		std::cerr << "Could not open file: " << fname << "\n";
+		fail = 1;
+		return false;
+	}
+	std::vector<Key> keys;
+	std::vector<std::string> ambig;
+	std::string line;
+	std::string seq;
+	Key key;
+	while (std::getline(is, line))
+	{
+		std::istringstream words(line);
+		if (!(words >> seq) || seq[0] == '>' || seq[0] == '#')
+			continue;
+		if (static_cast<int>(seq.size()) != merlen)
+		{
+			fprintf(stderr, "target kmer %s does not have length %d of the input\n", seq.c_str(), merlen);
+			fail = 1;
+			return false;
+		}
+		if (packKey(seq.data(), merlen, key))
+		{
+			keys.push_back(key);
+			continue;
+		}
+		if (!ambigSpace(merlen))
+		{
+			++nskipped;
+			continue;
+		}
+		ambig.push_back(ambigText(seq.data(), merlen));
+	}
+	targets.init(keys, ambig);
+	ntargets = targets.size();
+	reportSkipped();
+	if (targets.empty())
+	{
+		std::cerr << "No target kmers found in file: " << fname << "\n";
+		fail = 1;
+		return false;
+	}
+	fprintf(stderr, "Loading only the %lu kmers of the target panel (%.1f MB)\n", targets.size(), targets.bytes() / 1e6);
+	return true;
+}
+
+// parseJellyParallel parses each library into its own hash-sorted run on a pool of threads, then merges the runs
+// into the kmer table in parallel; the merge gives each thread a range of the hash space, which maps to a contiguous
+// range of table slots, so rows are placed where linear probing would put them without locking
+void kmer::parseJellyParallel (std::vector<std::string>& files, unsigned int nthreads)
+{
+	if ( files.empty() )
+	{
+		fprintf(stderr, "No files to parse in call to kmer::parseJellyParallel\n");
+		fail = 1;
+		return;
+	}
+	if (nthreads < 1)
+		nthreads = 1;
+	unsigned int i = 0;
+	unsigned int lib = 0;
+	std::vector<std::thread> workers;
+
+	// parse libraries into runs
+	std::vector<LibRun> runs(files.size());
+	std::atomic<unsigned int> nextlib(0);
+	for (i = 0; i < std::min(nthreads, static_cast<unsigned int>(files.size())); ++i)
+		workers.push_back(std::thread(&kmer::parseRuns, this, &files, &runs, &nextlib));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	merlen = runs[0].merlen;
+	libtotal.setSize(files.size());
+	size_t nambig = 0;
+	for (lib = 0; lib < files.size(); ++lib)
+	{
+		if (runs[lib].fail)
+		{
+			fail = 1;
+			return;
+		}
+		if (runs[lib].merlen != merlen)
+		{
+			fprintf(stderr, "kmer length %d in %s differs from length %d in the first file\n", runs[lib].merlen, files[lib].c_str(), merlen);
+			fail = 1;
+			return;
+		}
+		libtotal[lib] = runs[lib].total;
+		nambig += runs[lib].ambig.size();
+	}
+
+	// split the hash space into ranges and find where each run enters each range
+	int rangebits = 0;
+	while ((1U << rangebits) < nthreads * 8)
+		++rangebits;
+	size_t nranges = static_cast<size_t>(1) << rangebits;
+	std::vector< std::vector<size_t> > bounds(files.size(), std::vector<size_t>(nranges + 1, 0));
+	KmerCount start;
+	for (lib = 0; lib < files.size(); ++lib)
+	{
+		const std::vector<KmerCount>& recs = runs[lib].recs;
+		for (size_t r = 0; r < nranges; ++r)
+		{
+			start.hash = rangebits ? static_cast<uint64_t>(r) << (64 - rangebits) : 0;
+			bounds[lib][r] = std::lower_bound(recs.begin(), recs.end(), start, hashBefore) - recs.begin();
+		}
+		bounds[lib][nranges] = recs.size();
+	}
+
+	// count distinct kmers per range, size the table once, then place rows
+	std::vector<size_t> nkeys(nranges, 0);
+	std::vector< std::vector<uint64_t> > deferred(nranges);
+	std::atomic<unsigned int> nextrange(0);
+	for (i = 0; i < nthreads; ++i)
+		workers.push_back(std::thread(&kmer::mergeRuns, this, &runs, &bounds, &nextrange, &nkeys, &deferred, (std::vector<size_t>*)0));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+	size_t total = 0;
+	size_t nrecs = 0;
+	for (size_t r = 0; r < nranges; ++r)
+		total += nkeys[r];
+	for (lib = 0; lib < files.size(); ++lib)
+		nrecs += runs[lib].recs.size();
+	storage = std::max(total + nambig, nranges);
+
+	// store rows sparsely when most counts are zero and that at least halves the table
+	unsigned int width = countBytes(files);
+	double densebytes = (KMER_WORDS + (files.size() * width + sizeof(uint64_t) - 1) / sizeof(uint64_t)) * sizeof(uint64_t) / maxLoad;
+	double sparsebytes = (KMER_WORDS + 1) * sizeof(uint64_t) / maxLoad + sizeof(uint64_t) * nrecs / std::max(total, static_cast<size_t>(1));
+	bool sparserows = sparse > 0 || (sparse < 0 && 2 * sparsebytes <= densebytes);
+	datamap.init(files.size(), storage, 0, 0, width, sparserows);
+	std::vector<size_t> pairat(sparserows ? nranges : 0);
+	for (size_t r = 0; r < pairat.size(); ++r)
+	{
+		size_t n = 0;
+		for (lib = 0; lib < files.size(); ++lib)
+			n += bounds[lib][r + 1] - bounds[lib][r];
+		pairat[r] = datamap.shard(0).allotPairs(n);
+	}
+	if (sparserows)
+		fprintf(stderr, "Storing count rows sparsely: %.1f of %lu libraries per kmer, about %.0f bytes per kmer instead of %.0f\n",
+			nrecs / static_cast<double>(std::max(total, static_cast<size_t>(1))), files.size(), sparsebytes, densebytes);
+
+	std::cerr << "Merging " << total << " kmers from " << files.size() << " libraries...\n";
+	nextrange = 0;
+	for (i = 0; i < nthreads; ++i)
+		workers.push_back(std::thread(&kmer::mergeRuns, this, &runs, &bounds, &nextrange, &nkeys, &deferred, &pairat));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+	size_t placed = 0;
+	for (size_t r = 0; r < nranges; ++r)
+		placed += nkeys[r];
+	datamap.shard(0).countPlaced(placed);
+	for (lib = 0; lib < files.size(); ++lib)
+		std::vector<KmerCount>().swap(runs[lib].recs);
+
+	// rows that would have run past the end of their slot range, and kmers with ambiguous bases
+	size_t rowwords = KMER_WORDS + (files.size() + 1) / 2;
+	Key seqID;
+	bool added = false;
+	std::vector<unsigned int> counts(files.size());
+	for (size_t r = 0; r < nranges; ++r)
+	{
+		const std::vector<uint64_t>& rows = deferred[r];
+		for (size_t j = 0; j < rows.size(); j += rowwords)
+		{
+			memcpy(seqID.id, &rows[j], sizeof(Key));
+			memcpy(&counts[0], &rows[j + KMER_WORDS], files.size() * sizeof(unsigned int));
+			datamap.setRow(seqID, &counts[0], added);
+		}
+	}
+
+	// gather each kmer with ambiguous bases from every library, so its row is stored once (a sparse row rewritten
+	// per library would leave its old pairs behind)
+	size_t firstambig = ambigseq.size();
+	std::vector<unsigned int> ambigrows;
+	std::vector<char> ambigseen;
+	for (lib = 0; lib < files.size(); ++lib)
+	{
+		for (i = 0; i < runs[lib].ambig.size(); ++i)
+		{
+			seqtonum(runs[lib].ambig[i].first.c_str(), seqID);
+			if (!mayPass(seqID))
+				continue;
+			size_t a = (seqID.id[KMER_WORDS - 1] & ~ambigFlag) - firstambig;
+			if (a >= ambigseen.size())
+			{
+				ambigseen.resize(a + 1, 0);
+				ambigrows.resize((a + 1) * files.size(), 0);
+			}
+			unsigned int count = runs[lib].ambig[i].second;
+			unsigned int& cell = ambigrows[a * files.size() + lib];
+			cell = !canonical ? count : count < ~cell ? cell + count : ~0U;
+			ambigseen[a] = 1;
+		}
+	}
+	for (size_t a = 0; a < ambigseen.size(); ++a)
+	{
+		if (!ambigseen[a])
+			continue;
+		for (int w = 0; w < KMER_WORDS; ++w)
+			seqID.id[w] = 0;
+		seqID.id[0] = ambigFlag;
+		seqID.id[KMER_WORDS - 1] |= firstambig + a;
+		datamap.setRow(seqID, &ambigrows[a * files.size()], added);
+	}
+	kmertypes = datamap.size();
+	reportSkipped();
+}
+
+// parseRuns parses libraries into runs until none are left
+void kmer::parseRuns (const std::vector<std::string>* files, std::vector<LibRun>* runs, std::atomic<unsigned int>* nextlib) const
+{
+	unsigned int lib = 0;
+	while ((lib = (*nextlib)++) < files->size())
+		parseRun((*files)[lib].c_str(), &(*runs)[lib]);
+}
+
+// parseRun reads one Jellyfish file into a run sorted by kmer hash
+void kmer::parseRun (const char* file, LibRun* run) const
+{
+	fprintf(stderr, "reading file: %s\n", file);
+	JellyReader reader;
+	if (!reader.open(file))
+	{
+		fprintf(stderr, "Could not open file: %s\n", file);
+		run->fail = 1;
+		return;
+	}
+	run->merlen = reader.merLength();
+	if (run->merlen < 0)
+	{
+		fprintf(stderr, "%s%s\n", reader.bad() ? "Could not read file: " : "0 sequences found in file: ", file);
+		run->fail = 1;
+		return;
+	}
+	if (run->merlen < 1 || run->merlen > maxMerLength)
+	{
+		fprintf(stderr, "kmer length must be between 1 and %d (rebuild with a larger KMER_WORDS for longer kmers)\n", maxMerLength);
+		run->fail = 1;
+		return;
+	}
+	run->recs.reserve(reader.fileSize() / (run->merlen + nonseq_char));
+
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	KmerCount rec;
+	while (reader.next(seq, seqlen, count))
+	{
+		if (seqlen != run->merlen)
+		{
+			fprintf(stderr, "kmer %.*s does not have length %d\n", seqlen, seq, run->merlen);
+			run->fail = 1;
+			return;
+		}
+		if (!packKey(seq, seqlen, rec.key))
+		{
+			if (ambigSpace(seqlen))
+			{
+				run->total += count;
+				if (targetedSeq(ambigText(seq, seqlen)))
+					run->ambig.push_back(std::make_pair(std::string(seq, seqlen), static_cast<unsigned int>(count)));
+			}
+			else
+				++nskipped;
+			continue;
+		}
+		run->total += count;
+		if (!mayPass(rec.key))
+			continue;
+		rec.hash = datamap.hash(rec.key);
+		rec.count = count;
+		run->recs.push_back(rec);
+	}
+	if (reader.bad())
+	{
+		run->fail = 1;
+		return;
+	}
+
+	// sort, keeping the last count seen for a repeated kmer as parseJellyCounts does, or in canonical mode adding
+	// the counts of a kmer and its reverse complement
+	std::stable_sort(run->recs.begin(), run->recs.end());
+	std::vector<KmerCount>::iterator out = run->recs.begin();
+	unsigned int sum = 0;
+	for (std::vector<KmerCount>::iterator in = run->recs.begin(); in != run->recs.end(); ++in)
+	{
+		if (!canonical)
+			sum = in->count;
+		else
+			sum = sum < ~in->count ? sum + in->count : ~0U;
+		if (in + 1 != run->recs.end() && (in + 1)->hash == in->hash && (in + 1)->key == in->key)
+			continue;
+		*out = *in;
+		out->count = sum;
+		++out;
+		sum = 0;
+	}
+	run->recs.erase(out, run->recs.end());
+}
+
+// mergeRuns merges hash ranges of the runs until none are left; without pairat it only counts the distinct
+// kmers in each range, otherwise it writes each merged row to the slot linear probing would give it, deferring
+// rows that would spill past the range's last slot; a sparse table's rows go to the pairs allotted to the range at pairat
+void kmer::mergeRuns (const std::vector<LibRun>* runs, const std::vector< std::vector<size_t> >* bounds, std::atomic<unsigned int>* nextrange,
+	std::vector<size_t>* nkeys, std::vector< std::vector<uint64_t> >* deferred, const std::vector<size_t>* pairat)
+{
+	unsigned int nruns = runs->size();
+	size_t nranges = nkeys->size();
+	KmerTable<KeyHasher>& table = datamap.shard(0);
+	size_t slotsper = table.capacity() / nranges;
+	std::vector<unsigned int> counts(nruns);
+	size_t r = 0;
+	uint64_t h = 0;
+	Key key;
+	while ((r = (*nextrange)++) < nranges)
+	{
+		RunMerger merger(nruns);
+		for (unsigned int lib = 0; lib < nruns; ++lib)
+		{
+			const KmerCount* recs = (*runs)[lib].recs.data();
+			merger.add(lib, recs + (*bounds)[lib][r], recs + (*bounds)[lib][r + 1]);
+		}
+		size_t n = 0;
+		if (!pairat)
+		{
+			while (merger.next(h, key, 0))
+				++n;
+			(*nkeys)[r] = n;
+			continue;
+		}
+		size_t next = r * slotsper;
+		size_t last = next + slotsper;
+		size_t slot = 0;
+		std::vector<uint64_t>& spill = (*deferred)[r];
+		size_t rowwords = KMER_WORDS + (nruns + 1) / 2;
+		size_t at = table.sparse() ? (*pairat)[r] : 0;
+		while (merger.next(h, key, &counts[0]))
+		{
+			slot = std::max(table.home(h), next);
+			if (slot < last)
+			{
+				table.placeAt(slot, key, h);
+				if (table.sparse())
+					at = table.setPairs(slot, &counts[0], at);
+				else
+					table.setRow(slot, &counts[0]);
+				next = slot + 1;
+				++n;
+			}
+			else
+			{
+				spill.resize(spill.size() + rowwords, 0);
+				memcpy(&spill[spill.size() - rowwords], key.id, sizeof(Key));
+				memcpy(&spill[spill.size() - rowwords + KMER_WORDS], &counts[0], nruns * sizeof(unsigned int));
+			}
+		}
+		(*nkeys)[r] = n;
+	}
+}
+
+// parseJellySharded splits the input into chunks read by parser threads, which route each record to the
+// shard owning the top shardbits bits of its hash; each shard has one owner thread, so inserts need no locks
+void kmer::parseJellySharded (std::vector<std::string>& files, unsigned int nthreads, int shardbits)
+{
+	if ( files.empty() )
+	{
+		fprintf(stderr, "No files to parse in call to kmer::parseJellySharded\n");
+		fail = 1;
+		return;
+	}
+	if (shardbits < 0)
+	{
+		shardbits = 0;
+		while ((2U << shardbits) <= nthreads / 2)
+			++shardbits;
+	}
+	size_t nshards = static_cast<size_t>(1) << shardbits;
+	unsigned int nparsers = nthreads > nshards ? nthreads - nshards : 1;
+	size_t i = 0;
+
+	std::vector<ChunkWork> work;
+	std::vector<JellyReader*> streams;
+	size_t upper = 0;
+	if (!planChunks(files, &work, &streams, &upper))
+		return;
+	fprintf(stderr, "Loading %lu chunks with %u parser threads into %lu shards\n", work.size(), nparsers, nshards);
+
+	datamap.init(files.size(), storage, shardbits, 0, countBytes(files));
+	std::vector<ShardQueue> queues(nshards);
+	std::vector<ParserState> parsers(nparsers);
+	std::atomic<size_t> nextwork(0);
+	std::vector<std::thread> owners;
+	std::vector<std::thread> workers;
+	for (i = 0; i < nshards; ++i)
+		owners.push_back(std::thread(&kmer::fillShard, this, i, &queues[i]));
+	for (i = 0; i < nparsers; ++i)
+	{
+		parsers[i].total.resize(files.size(), 0);
+		workers.push_back(std::thread(&kmer::parseChunks, this, &files, &work, &streams, &nextwork, &queues, &parsers[i]));
+	}
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	for (i = 0; i < nshards; ++i)
+		queues[i].close();
+	for (i = 0; i < owners.size(); ++i)
+		owners[i].join();
+	for (i = 0; i < streams.size(); ++i)
+		delete streams[i];
+	collectParsers(parsers);
+}
+
+// parseJellyAtomic has every thread parse chunks of input and insert straight into one shared table,
+// claiming empty slots with compare-and-swap; the table is sized up front from the summed file sizes
+void kmer::parseJellyAtomic (std::vector<std::string>& files, unsigned int nthreads)
+{
+	if ( files.empty() )
+	{
+		fprintf(stderr, "No files to parse in call to kmer::parseJellyAtomic\n");
+		fail = 1;
+		return;
+	}
+	size_t i = 0;
+	std::vector<ChunkWork> work;
+	std::vector<JellyReader*> streams;
+	size_t upper = 0;
+	if (!planChunks(files, &work, &streams, &upper))
+		return;
+	if (!presized && upper > storage)
+		storage = upper;
+	fprintf(stderr, "Loading %lu chunks with %u threads into a shared table for %lu kmers\n", work.size(), nthreads, storage);
+
+	datamap.init(files.size(), storage, 0, 0, countBytes(files));
+	std::vector<ParserState> parsers(nthreads);
+	std::atomic<size_t> nextwork(0);
+	std::vector<std::thread> workers;
+	for (i = 0; i < nthreads; ++i)
+	{
+		parsers[i].total.resize(files.size(), 0);
+		workers.push_back(std::thread(&kmer::parseChunks, this, &files, &work, &streams, &nextwork, (std::vector<ShardQueue>*)0, &parsers[i]));
+	}
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	for (i = 0; i < streams.size(); ++i)
+		delete streams[i];
+	size_t placed = 0;
+	for (i = 0; i < nthreads; ++i)
+		placed += parsers[i].added;
+	datamap.shard(0).countPlaced(placed);
+
+	// records that found no free slot within the probe limit
+	bool added = false;
+	for (i = 0; i < nthreads; ++i)
+	{
+		const std::vector<ShardRec>& overflow = parsers[i].overflow;
+		if (!overflow.empty())
+			std::cerr << "Inserting " << overflow.size() << " kmers that did not fit the shared table or were reverse complemented...\n";
+		for (std::vector<ShardRec>::const_iterator rec = overflow.begin(); rec != overflow.end(); ++rec)
+			putCount(rec->key, rec->lib, rec->count, added);
+	}
+	collectParsers(parsers);
+}
+
+// planChunks checks kmer lengths and cuts each file into chunks for parser threads; files that cannot be mapped
+// become a single chunk and are left open in streams; upper is set to the summed line estimates of all files
+bool kmer::planChunks (const std::vector<std::string>& files, std::vector<ChunkWork>* work, std::vector<JellyReader*>* streams, size_t* upper)
+{
+	unsigned int lib = 0;
+	ChunkWork chunk;
+	streams->assign(files.size(), (JellyReader*)0);
+	*upper = 0;
+	JellyReader* opened = new JellyReader;
+	for (lib = 0; lib < files.size(); ++lib)
+	{
+		JellyReader& reader = *opened;
+		if (!reader.open(files[lib].c_str()))
+		{
+			std::cerr << "Could not open file: " << files[lib] << "\n";
+			fail = 1;
+			break;
+		}
+		int filemer = jellyMerLength(reader);
+		if (filemer < 0)
+		{
+			std::cerr << (reader.bad() ? "Could not read file: " : "0 sequences found in file: ") << files[lib] << "\n";
+			fail = 1;
+			break;
+		}
+		if (lib == 0)
+		{
+			if (filemer < 1 || filemer > maxMerLength)
+			{
+				fprintf(stderr, "kmer length must be between 1 and %d (rebuild with a larger KMER_WORDS for longer kmers)\n", maxMerLength);
+				fail = 1;
+				break;
+			}
+			merlen = filemer;
+			if (!presized)
+			{
+				storage = estLines(reader.fileSize(), merlen, nonseq_char);
+				storage = targetCap(storage + storage * xtra_reserve);
+			}
+		}
+		else if (filemer != merlen)
+		{
+			fprintf(stderr, "kmer length %d in %s differs from length %d in the first file\n", filemer, files[lib].c_str(), merlen);
+			fail = 1;
+			break;
+		}
+		*upper = targetCap(*upper + estLines(reader.fileSize(), merlen, nonseq_char));
+		chunk.lib = lib;
+		if (reader.mapped())
+		{
+			for (chunk.begin = 0; chunk.begin < reader.fileSize(); chunk.begin += parseChunk)
+			{
+				chunk.end = std::min(chunk.begin + parseChunk, reader.fileSize());
+				work->push_back(chunk);
+			}
+		}
+		else
+		{
+			chunk.begin = 0;
+			chunk.end = 0; // read the whole stream
+			work->push_back(chunk);
+			(*streams)[lib] = opened;
+			opened = new JellyReader;
+			continue;
+		}
+		reader.close();
+	}
+	delete opened;
+	if (fail)
+	{
+		for (lib = 0; lib < files.size(); ++lib)
+			delete (*streams)[lib];
+		streams->clear();
+		return false;
+	}
+	fprintf(stderr, "kmer length is %d\n", merlen);
+	libtotal.setSize(files.size());
+	return true;
+}
+
+// collectParsers adds the parser threads' library totals and kmers with ambiguous bases to the dataset
+void kmer::collectParsers (std::vector<ParserState>& parsers)
+{
+	Key seqID;
+	bool added = false;
+	for (size_t i = 0; i < parsers.size(); ++i)
+	{
+		if (parsers[i].fail)
+			fail = 1;
+		for (unsigned int lib = 0; lib < libtotal.size(); ++lib)
+			libtotal[lib] += parsers[i].total[lib];
+		for (size_t j = 0; j < parsers[i].ambigseq.size(); ++j)
+		{
+			seqtonum(parsers[i].ambigseq[j].c_str(), seqID);
+			if (mayPass(seqID))
+				putCount(seqID, parsers[i].ambigcount[j].lib, parsers[i].ambigcount[j].count, added);
+		}
+	}
+	kmertypes = datamap.size();
+	reportSkipped();
+}
+
+// parseChunks parses chunks of input until no chunks are left, routing the records to shard queues in batches,
+// or inserting them concurrently into the shared table when there are no queues
+void kmer::parseChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, const std::vector<JellyReader*>* streams,
+	std::atomic<size_t>* nextwork, std::vector<ShardQueue>* queues, ParserState* state)
+{
+	size_t nshards = queues ? queues->size() : 0;
+	KmerTable<KeyHasher>& shared = datamap.shard(0);
+	bool added = false;
+	size_t slot = 0;
+	std::vector< std::vector<ShardRec>* > batches(nshards);
+	size_t s = 0;
+	for (s = 0; s < nshards; ++s)
+	{
+		batches[s] = new std::vector<ShardRec>;
+		batches[s]->reserve(shardBatch);
+	}
+	JellyReader mapped;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	ShardRec rec;
+	bool flipped = false;
+	size_t w = 0;
+	while ((w = (*nextwork)++) < work->size())
+	{
+		const ChunkWork& chunk = (*work)[w];
+		const char* file = (*files)[chunk.lib].c_str();
+		if (chunk.begin == 0)
+			fprintf(stderr, "reading file: %s\n", file);
+		JellyReader& reader = (*streams)[chunk.lib] ? *(*streams)[chunk.lib] : mapped;
+		if (!(*streams)[chunk.lib])
+		{
+			if (!reader.open(file))
+			{
+				fprintf(stderr, "Could not open file: %s\n", file);
+				state->fail = 1;
+				break;
+			}
+			reader.setRange(chunk.begin, chunk.end);
+		}
+		rec.lib = chunk.lib;
+		while (reader.next(seq, seqlen, count))
+		{
+			if (seqlen != merlen)
+			{
+				fprintf(stderr, "kmer %.*s does not have length %d\n", seqlen, seq, merlen);
+				state->fail = 1;
+				break;
+			}
+			rec.count = count;
+			if (!packKey(seq, seqlen, rec.key, &flipped))
+			{
+				if (ambigSpace(seqlen))
+				{
+					state->total[chunk.lib] += count;
+					if (targetedSeq(ambigText(seq, seqlen)))
+					{
+						state->ambigcount.push_back(rec);
+						state->ambigseq.push_back(std::string(seq, seqlen));
+					}
+				}
+				else
+					++nskipped;
+				continue;
+			}
+			state->total[chunk.lib] += count;
+			if (!mayPass(rec.key))
+				continue;
+			rec.hash = datamap.hash(rec.key);
+			if (!queues && flipped)
+			{
+				// the same library may hold the kmer as given, so its count is added after the parallel phase
+				state->overflow.push_back(rec);
+				continue;
+			}
+			if (!queues)
+			{
+				slot = shared.insertConcurrent(rec.key, rec.hash, added);
+				if (slot == KmerTable<KeyHasher>::npos)
+					state->overflow.push_back(rec);
+				else
+				{
+					shared.setCount(slot, rec.lib, rec.count);
+					state->added += added;
+				}
+				continue;
+			}
+			s = datamap.shardOf(rec.hash);
+			batches[s]->push_back(rec);
+			if (batches[s]->size() == shardBatch)
+			{
+				(*queues)[s].push(batches[s]);
+				batches[s] = new std::vector<ShardRec>;
+				batches[s]->reserve(shardBatch);
+			}
+		}
+		if (reader.bad())
+			state->fail = 1;
+		reader.close();
+		if (state->fail)
+			break;
+	}
+	for (s = 0; s < nshards; ++s)
+	{
+		if (batches[s]->empty())
+			delete batches[s];
+		else
+			(*queues)[s].push(batches[s]);
+	}
+}
+
+// fillShard inserts the batches routed to one shard; this thread is the only writer to the shard
+void kmer::fillShard (size_t shard, ShardQueue* queue)
+{
+	KmerTable<KeyHasher>& table = datamap.shard(shard);
+	std::vector<ShardRec>* batch = 0;
+	bool added = false;
+	while ((batch = queue->pop()))
+	{
+		for (std::vector<ShardRec>::const_iterator rec = batch->begin(); rec != batch->end(); ++rec)
+		{
+			if (canonical)
+				table.addCount(table.insert(rec->key, added), rec->lib, rec->count);
+			else
+				table.setCount(table.insert(rec->key, added), rec->lib, rec->count);
+		}
+		delete batch;
+	}
+}
+
+// estimateKmers gives an upper bound on the distinct kmers in the input from the sizes of the regular files
+// (streams cannot be sized without consuming them and count as 0)
+size_t kmer::estimateKmers (const std::vector<std::string>& files)
+{
+	size_t nbytes = 0;
+	int filemer = 0;
+	struct stat sb;
+	JellyReader reader;
+	for (std::vector<std::string>::const_iterator fIter = files.begin(); fIter != files.end(); ++fIter)
+	{
+		if (::stat(fIter->c_str(), &sb) != 0 || !S_ISREG(sb.st_mode))
+			continue;
+		nbytes += sb.st_size;
+		if (filemer <= 0 && reader.open(fIter->c_str()))
+		{
+			filemer = jellyMerLength(reader);
+			reader.close();
+		}
+	}
+	return filemer > 0 ? targetCap(estLines(nbytes, filemer, nonseq_char)) : 0;
+}
+
+// sketchKmers estimates the distinct kmers in the union of all input files with a HyperLogLog pass on nthreads
+// threads and sizes the kmer table for that many plus three standard errors, so loading never grows the table;
+// kmers off the target panel or rejected by a filter from buildFilter are left out; returns false and leaves the sizing to the parser if
+// an input cannot be mapped (a stream can only be read once)
+bool kmer::sketchKmers (const std::vector<std::string>& files, unsigned int nthreads)
+{
+	if (nthreads < 1)
+		nthreads = 1;
+	size_t i = 0;
+	std::vector<ChunkWork> work;
+	if (!mapChunks(files, &work))
+		return false;
+
+	std::vector<HyperLogLog> sketches(std::min(static_cast<size_t>(nthreads), std::max(work.size(), static_cast<size_t>(1))));
+	std::atomic<size_t> nextwork(0);
+	std::atomic<int> bad(0);
+	std::vector<std::thread> workers;
+	for (i = 0; i < sketches.size(); ++i)
+		workers.push_back(std::thread(&kmer::sketchChunks, this, &files, &work, &nextwork, &sketches[i], &bad));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	if (bad)
+		return false;
+	for (i = 1; i < sketches.size(); ++i)
+		sketches[0].merge(sketches[i]);
+
+	double est = sketches[0].estimate();
+	double err = sketches[0].relativeError();
+	storage = targetCap(ceil(est * (1.0 + 3.0 * err)));
+	presized = true;
+	fprintf(stderr, "Estimated %.0f distinct kmers in the input%s (standard error %.1f%%), sizing the kmer table for %lu\n",
+		est, countfilter.empty() && libfilter.empty() ? "" : " that pass the filter", 100.0 * err, storage);
+	return true;
+}
+
+// sketchChunks adds the kmers of chunks of input to sketch until none are left
+void kmer::sketchChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, std::atomic<size_t>* nextwork,
+	HyperLogLog* sketch, std::atomic<int>* bad) const
+{
+	KeyHasher hasher;
+	JellyReader reader;
+	Key key;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	size_t w = 0;
+	while ((w = (*nextwork)++) < work->size())
+	{
+		const ChunkWork& chunk = (*work)[w];
+		if (!reader.open((*files)[chunk.lib].c_str()))
+		{
+			*bad = 1;
+			break;
+		}
+		reader.setRange(chunk.begin, chunk.end);
+		while (reader.next(seq, seqlen, count))
+		{
+			if (packKey(seq, seqlen, key))
+			{
+				if (mayPass(key))
+					sketch->add(hasher(key));
+				continue;
+			}
+			// kmers with ambiguous bases are hashed by their sequence as the side table keeps it; the filters
+			// do not cover them, but the target panel does
+			if (!ambigSpace(seqlen))
+				continue;
+			std::string text = ambigText(seq, seqlen);
+			if (!targetedSeq(text))
+				continue;
+			uint64_t h = ambigFlag;
+			for (size_t c = 0; c < text.size(); ++c)
+				h = fmix64(h ^ text[c]);
+			sketch->add(h);
+		}
+		if (reader.bad())
+			*bad = 1;
+		reader.close();
+	}
+}
+
+// mapChunks cuts every input file into chunks for pre-pass threads; returns false if any file cannot be mapped
+bool kmer::mapChunks (const std::vector<std::string>& files, std::vector<ChunkWork>* work) const
+{
+	ChunkWork chunk;
+	JellyReader reader;
+	for (chunk.lib = 0; chunk.lib < files.size(); ++chunk.lib)
+	{
+		if (!reader.open(files[chunk.lib].c_str()) || !reader.mapped())
+			return false;
+		for (chunk.begin = 0; chunk.begin < reader.fileSize(); chunk.begin += parseChunk)
+		{
+			chunk.end = std::min(chunk.begin + parseChunk, reader.fileSize());
+			work->push_back(chunk);
+		}
+		reader.close();
+	}
+	return true;
+}
+
+// buildFilter reads the input once on nthreads threads into counting filters that bound each kmer's total count
+// and number of libraries, so ingest can drop kmers that cannot reach mincount or minlibs without giving them a
+// table entry; the filters are sized from sketchKmers if it has run and from the input size otherwise; returns
+// false if an input cannot be mapped, leaving only the exact check made when results are written
+bool kmer::buildFilter (const std::vector<std::string>& files, unsigned int nthreads)
+{
+	if (mincount <= 1 && minlibs <= 1)
+		return true;
+	if (nthreads < 1)
+		nthreads = 1;
+	size_t i = 0;
+	std::vector<ChunkWork> work;
+	if (!mapChunks(files, &work))
+	{
+		fprintf(stderr, "WARNING: not every input can be read twice, so kmers below -min-count or -min-libs are only dropped from the output\n");
+		return false;
+	}
+	size_t nkeys = presized ? storage : estimateKmers(files);
+	if (mincount > 1)
+		countfilter.init(nkeys * filterCounters);
+	if (minlibs > 1)
+		libfilter.init(nkeys * filterCounters);
+	fprintf(stderr, "Filtering kmers below -min-count %u or -min-libs %u with %.1f MB of counters...\n",
+		std::max(mincount, 1U), std::max(minlibs, 1U), (countfilter.bytes() + libfilter.bytes()) / 1e6);
+
+	std::atomic<size_t> nextwork(0);
+	std::atomic<int> bad(0);
+	std::vector<std::thread> workers;
+	for (i = 0; i < std::min(static_cast<size_t>(nthreads), std::max(work.size(), static_cast<size_t>(1))); ++i)
+		workers.push_back(std::thread(&kmer::filterChunks, this, &files, &work, &nextwork, &bad));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	if (bad)
+	{
+		clearFilter();
+		return false;
+	}
+	return true;
+}
+
+// clearFilter frees the filters once the input is loaded
+void kmer::clearFilter ()
+{
+	countfilter.clear();
+	libfilter.clear();
+}
+
+// filterChunks adds the kmers of chunks of input to the filters until none are left; kmers with ambiguous bases are
+// not filtered
+void kmer::filterChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, std::atomic<size_t>* nextwork, std::atomic<int>* bad)
+{
+	KeyHasher hasher;
+	JellyReader reader;
+	Key key;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	uint64_t h = 0;
+	size_t w = 0;
+	while ((w = (*nextwork)++) < work->size())
+	{
+		const ChunkWork& chunk = (*work)[w];
+		if (!reader.open((*files)[chunk.lib].c_str()))
+		{
+			*bad = 1;
+			break;
+		}
+		reader.setRange(chunk.begin, chunk.end);
+		while (reader.next(seq, seqlen, count))
+		{
+			if (!packKey(seq, seqlen, key) || !targeted(key))
+				continue;
+			h = hasher(key);
+			if (!countfilter.empty())
+				countfilter.add(h, count < 0xff ? count : 0xff);
+			if (!libfilter.empty())
+				libfilter.add(h, 1);
+		}
+		if (reader.bad())
+			*bad = 1;
+		reader.close();
+	}
+}
+
+// mayPass returns false for a kmer off the target panel or that the filters show cannot reach mincount or minlibs
+bool kmer::mayPass (const Key& key) const
+{
+	if (!targeted(key))
+		return false;
+	if (countfilter.empty() && libfilter.empty())
+		return true;
+	if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+		return true;
+	uint64_t h = KeyHasher()(key);
+	return (countfilter.empty() || countfilter.least(h) >= std::min(mincount, 0xffU))
+		&& (libfilter.empty() || libfilter.least(h) >= std::min(minlibs, 0xffU));
+}
+
+// targeted returns whether a kmer is on the target panel, always true without one
+bool kmer::targeted (const Key& key) const
+{
+	if (targets.empty())
+		return true;
+	if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+	{
+		uint64_t id = key.id[KMER_WORDS - 1] & ~ambigFlag;
+		return id < ambigseq.size() && targetedSeq(ambigseq[id]);
+	}
+	return targets.contains(key, KeyHasher()(key));
+}
+
+// reportSkipped warns once about the kmers with ambiguous bases skipped since it last ran, which a kmer of
+// maxMerLength bases leaves no room to mark
+void kmer::reportSkipped ()
+{
+	size_t n = nskipped.exchange(0);
+	if (n > 0)
+		fprintf(stderr, "WARNING: Skipped %lu kmers with ambiguous bases, which kmers of %d bases cannot hold (rebuild with -DKMER_WORDS=%d to keep them)\n",
+			n, merlen, KMER_WORDS + 1);
+}
+
+// targetedSeq returns whether a kmer with ambiguous bases, as ambigText gives it, is on the target panel, always
+// true without one
+bool kmer::targetedSeq (const std::string& seq) const
+{
+	return targets.empty() || targets.containsSeq(seq);
+}
+
+// targetCap bounds an estimate of the distinct kmers to load by the size of the target panel
+size_t kmer::targetCap (size_t n) const
+{
+	return targets.empty() ? n : std::min(n, targets.size());
+}
+
+// passes returns whether a kmer's library counts reach mincount and minlibs
+bool kmer::passes (const unsigned int row []) const
+{
+	if (mincount <= 1 && minlibs <= 1)
+		return true;
+	size_t sum = 0;
+	unsigned int nlib = 0;
+	for (size_t i = 0; i < libtotal.size(); ++i)
+	{
+		sum += row[i];
+		nlib += row[i] > 0;
+	}
+	return sum >= mincount && nlib >= minlibs;
+}
+
+// countBytes returns the bytes each stored count takes: tablebytes if set, or else the fewest bytes that hold
+// twice the largest count in the first countSample lines of each regular input file
+unsigned int kmer::countBytes (const std::vector<std::string>& files)
+{
+	if (tablebytes)
+		return tablebytes;
+	unsigned long int most = 0;
+	bool sampled = false;
+	struct stat sb;
+	JellyReader reader;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	for (std::vector<std::string>::const_iterator fIter = files.begin(); fIter != files.end(); ++fIter)
+	{
+		if (::stat(fIter->c_str(), &sb) != 0 || !S_ISREG(sb.st_mode) || !reader.open(fIter->c_str()))
+			continue;
+		for (size_t n = 0; n < countSample && reader.next(seq, seqlen, count); ++n)
+			most = std::max(most, count);
+		sampled = true;
+		reader.close();
+	}
+	tablebytes = !sampled ? sizeof(unsigned int) : 2 * most < 0xff ? 1 : 2 * most < 0xffff ? 2 : sizeof(unsigned int);
+	fprintf(stderr, "Storing counts in %u byte(s)\n", tablebytes);
+	return tablebytes;
+}
+
+// memoryEstimate approximates the bytes needed to hold nkeys kmers with their counts in memory
+size_t kmer::memoryEstimate (size_t nkeys, unsigned int nfiles) const
+{
+	size_t width = tablebytes ? tablebytes : sizeof(unsigned int);
+	size_t slotbytes = sizeof(Key) + ((nfiles * width + sizeof(uint64_t) - 1) / sizeof(uint64_t)) * sizeof(uint64_t) + 1;
+	return nkeys / maxLoad * slotbytes;
+}
+
+// spillPartitions reads the input once, setting the library totals and writing each (kmer, library, count)
+// record to one of 2^partbits partition files picked by the top bits of the kmer hash
+bool kmer::spillPartitions (std::vector<std::string>& files, int partbits, const std::string& prefix, std::vector<std::string>* parts)
+{
+	size_t nparts = static_cast<size_t>(1) << partbits;
+	size_t p = 0;
+	std::vector<FILE*> fp(nparts, (FILE*)0);
+	std::vector< std::vector<SpillRec> > buf(nparts);
+	std::stringstream name;
+	parts->clear();
+	for (p = 0; p < nparts; ++p)
+	{
+		name.str(std::string());
+		name << prefix << ".part" << p;
+		parts->push_back(name.str());
+		if (fexists(name.str().c_str()))
+		{
+			std::cerr << "File already exists: " << name.str() << "\n";
+			fail = 1;
+			break;
+		}
+		if (!(fp[p] = fopen(name.str().c_str(), "wb")))
+		{
+			std::cerr << "Could not open partition file: " << name.str() << "\n";
+			fail = 1;
+			break;
+		}
+		buf[p].reserve(spillBuffer);
+	}
+
+	JellyReader reader;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	SpillRec rec;
+	unsigned int lib = 0;
+	libtotal.setSize(files.size());
+	fprintf(stderr, "Spilling input to %lu partitions...\n", nparts);
+	for (lib = 0; lib < files.size() && !fail; ++lib)
+	{
+		std::cerr << "reading file: " << files[lib] << "\n";
+		if (!reader.open(files[lib].c_str()))
+		{
+			std::cerr << "Could not open file: " << files[lib] << "\n";
+			fail = 1;
+			break;
+		}
+		int filemer = jellyMerLength(reader);
+		if (filemer < 1 || filemer > maxMerLength || (lib > 0 && filemer != merlen))
+		{
+			fprintf(stderr, "Missing or invalid kmer length in %s\n", files[lib].c_str());
+			fail = 1;
+			break;
+		}
+		merlen = filemer;
+		rec.lib = lib;
+		while (reader.next(seq, seqlen, count))
+		{
+			if (seqlen != merlen)
+			{
+				fprintf(stderr, "kmer %.*s does not have length %d\n", seqlen, seq, merlen);
+				fail = 1;
+				break;
+			}
+			if (!seqtonum(seq, rec.key))
+				continue;
+			libtotal[lib] += count;
+			if (!mayPass(rec.key))
+				continue;
+			rec.count = count;
+			p = partbits ? datamap.hash(rec.key) >> (64 - partbits) : 0;
+			buf[p].push_back(rec);
+			if (buf[p].size() == spillBuffer)
+			{
+				if (fwrite(&buf[p][0], sizeof(SpillRec), buf[p].size(), fp[p]) != buf[p].size())
+				{
+					std::cerr << "Could not write partition file: " << (*parts)[p] << "\n";
+					fail = 1;
+					break;
+				}
+				buf[p].clear();
+			}
+		}
+		if (reader.bad())
+			fail = 1;
+		reader.close();
+	}
+	for (p = 0; p < nparts; ++p)
+	{
+		if (!fp[p])
+			continue;
+		if (!fail && !buf[p].empty() && fwrite(&buf[p][0], sizeof(SpillRec), buf[p].size(), fp[p]) != buf[p].size())
+		{
+			std::cerr << "Could not write partition file: " << (*parts)[p] << "\n";
+			fail = 1;
+		}
+		if (fclose(fp[p]) != 0)
+			fail = 1;
+	}
+	if (fail)
+	{
+		for (p = 0; p < nparts; ++p)
+		{
+			if (fp[p])
+				remove((*parts)[p].c_str());
+		}
+		return false;
+	}
+	reportSkipped();
+	return true;
+}
+
+// loadPartition replaces the kmer table with the records of one partition file
+bool kmer::loadPartition (const std::string& part, int partbits)
+{
+	FILE* fp = fopen(part.c_str(), "rb");
+	if (!fp)
+	{
+		std::cerr << "Could not open partition file: " << part << "\n";
+		fail = 1;
+		return false;
+	}
+	struct stat sb;
+	size_t nrec = ::stat(part.c_str(), &sb) == 0 ? sb.st_size / sizeof(SpillRec) : 0;
+	datamap.init(libtotal.size(), nrec, 0, partbits, tablebytes ? tablebytes : sizeof(unsigned int));
+	std::vector<SpillRec> buf(spillBuffer);
+	size_t nread = 0;
+	bool added = false;
+	while ((nread = fread(&buf[0], sizeof(SpillRec), buf.size(), fp)) > 0)
+	{
+		for (size_t i = 0; i < nread; ++i)
+			putCount(buf[i].key, buf[i].lib, buf[i].count, added);
+	}
+	if (ferror(fp))
+	{
+		std::cerr << "Could not read partition file: " << part << "\n";
+		fail = 1;
+	}
+	fclose(fp);
+	kmertypes = datamap.size();
+	return !fail;
+}
+
+// indexHashCheck is the kmer hash of a fixed key, recorded in index files to catch a change of hash function
+static uint64_t indexHashCheck ()
+{
+	Key key;
+	for (int i = 0; i < KMER_WORDS; ++i)
+		key.id[i] = 0x0123456789abcdefULL + i;
+	return KeyHasher()(key);
+}
+
+// padIndex writes zeros from pos up to the next section boundary and returns it
+static uint64_t padIndex (std::ofstream& os, uint64_t pos)
+{
+	static const char zeros [indexAlign] = {0};
+	uint64_t end = indexPadded(pos);
+	os.write(zeros, end - pos);
+	return end;
+}
+
+// saveIndex writes the kmer table, library totals, and kmers with ambiguous bases to fname (see kmerIndex.h), so that
+// loadIndex can take them up in a later run without parsing the input; the file is written under a temporary name and
+// then renamed, so fname may be the index the table is attached to
+bool kmer::saveIndex (const std::string& fname) const
+{
+	std::string tmpname = fname + ".tmp";
+	std::ofstream os(tmpname.c_str(), std::ios::binary);
+	if (os.fail())
+	{
+		std::cerr << "Could not open file: " << tmpname << "\n";
+		fail = 1;
+		return false;
+	}
+	std::cerr << "Saving kmer index to file: " << fname << "\n";
+	IndexHeader head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, indexMagic, sizeof(indexMagic));
+	head.keywords = KMER_WORDS;
+	head.merlen = merlen;
+	head.nlibs = libtotal.size();
+	head.countbytes = datamap.countBytes();
+	head.sparse = datamap.sparse();
+	head.shardbits = datamap.shardBits();
+	head.skipbits = datamap.skipBits();
+	head.canonical = canonical;
+	head.mincount = mincount;
+	head.minlibs = minlibs;
+	head.ntargets = ntargets;
+	head.hashcheck = indexHashCheck();
+	head.nkmers = datamap.size();
+	head.nambig = ambigseq.size();
+
+	size_t nshards = datamap.nshards();
+	size_t i = 0;
+	std::vector<IndexShard> shards(nshards);
+	uint64_t pos = indexPadded(sizeof(head) + head.nlibs * sizeof(uint64_t) + nshards * sizeof(IndexShard));
+	for (i = 0; i < nshards; ++i)
+	{
+		const KmerTable<KeyHasher>& table = datamap.shard(i);
+		IndexShard& d = shards[i];
+		d.capacity = table.capacity();
+		d.size = table.size();
+		d.npairs = table.sparse() ? table.npairs() : 0;
+		d.nwide = table.wideCounts().size();
+		d.ctrloffset = pos;
+		d.slaboffset = pos = indexPadded(pos + d.capacity);
+		d.pairoffset = pos = indexPadded(pos + d.capacity * table.stride() * sizeof(uint64_t));
+		d.wideoffset = pos = indexPadded(pos + d.npairs * sizeof(uint64_t));
+		pos = indexPadded(pos + d.nwide * 2 * sizeof(uint64_t));
+	}
+	head.ambigoffset = pos;
+
+	os.write(reinterpret_cast<const char*>(&head), sizeof(head));
+	for (i = 0; i < head.nlibs; ++i)
+	{
+		uint64_t total = libtotal[i];
+		os.write(reinterpret_cast<const char*>(&total), sizeof(total));
+	}
+	os.write(reinterpret_cast<const char*>(&shards[0]), nshards * sizeof(IndexShard));
+	pos = padIndex(os, sizeof(head) + head.nlibs * sizeof(uint64_t) + nshards * sizeof(IndexShard));
+	for (i = 0; i < nshards && !os.fail(); ++i)
+	{
+		const KmerTable<KeyHasher>& table = datamap.shard(i);
+		const IndexShard& d = shards[i];
+		if (d.capacity)
+		{
+			os.write(reinterpret_cast<const char*>(table.ctrlData()), d.capacity);
+			pos = padIndex(os, pos + d.capacity);
+			os.write(reinterpret_cast<const char*>(table.slabData()), d.capacity * table.stride() * sizeof(uint64_t));
+			pos = padIndex(os, pos + d.capacity * table.stride() * sizeof(uint64_t));
+		}
+		if (d.npairs)
+			os.write(reinterpret_cast<const char*>(table.pairData()), d.npairs * sizeof(uint64_t));
+		pos = padIndex(os, pos + d.npairs * sizeof(uint64_t));
+		for (std::unordered_map<uint64_t, unsigned int>::const_iterator w = table.wideCounts().begin(); w != table.wideCounts().end(); ++w)
+		{
+			uint64_t rec [2] = {w->first, w->second};
+			os.write(reinterpret_cast<const char*>(rec), sizeof(rec));
+		}
+		pos = padIndex(os, pos + d.nwide * 2 * sizeof(uint64_t));
+	}
+	for (i = 0; i < ambigseq.size(); ++i)
+		os.write(ambigseq[i].data(), merlen);
+	os.close();
+	if (os.fail() || rename(tmpname.c_str(), fname.c_str()) != 0)
+	{
+		std::cerr << "Could not write index file: " << fname << "\n";
+		remove(tmpname.c_str());
+		fail = 1;
+		return false;
+	}
+	return true;
+}
+
+// loadIndex maps an index written by saveIndex and attaches the kmer table to it in place; the index's -min-count
+// and -min-libs are kept if they are stricter than this run's, since kmers below them were never stored
+bool kmer::loadIndex (const std::string& fname)
+{
+	if (!indexmap.open(fname.c_str()))
+	{
+		fail = 1;
+		return false;
+	}
+	char* base = indexmap.data();
+	size_t len = indexmap.size();
+	IndexHeader head;
+	memcpy(&head, base, sizeof(head));
+	size_t nshards = static_cast<size_t>(1) << std::min(head.shardbits, 31U);
+	size_t i = 0;
+	bool valid = memcmp(head.magic, indexMagic, sizeof(indexMagic)) == 0 && head.merlen > 0 && head.shardbits <= 16
+		&& (head.countbytes == 1 || head.countbytes == 2 || head.countbytes == 4)
+		&& sizeof(head) + head.nlibs * sizeof(uint64_t) + nshards * sizeof(IndexShard) <= len
+		&& head.ambigoffset + head.nambig * head.merlen <= len;
+	if (valid && (head.keywords != KMER_WORDS || head.hashcheck != indexHashCheck()))
+	{
+		fprintf(stderr, "%s was written by a kmpare build with a different KMER_WORDS or kmer hash\n", fname.c_str());
+		indexmap.close();
+		fail = 1;
+		return false;
+	}
+	const IndexShard* shards = reinterpret_cast<const IndexShard*>(base + sizeof(head) + head.nlibs * sizeof(uint64_t));
+	size_t stride = KMER_WORDS + (head.sparse ? 1 : (head.nlibs * head.countbytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	for (i = 0; valid && i < nshards; ++i)
+	{
+		const IndexShard& d = shards[i];
+		valid = (d.capacity & (d.capacity - 1)) == 0 && d.size <= d.capacity && d.ctrloffset + d.capacity <= len
+			&& d.slaboffset % sizeof(uint64_t) == 0 && d.slaboffset + d.capacity * stride * sizeof(uint64_t) <= len
+			&& d.pairoffset % sizeof(uint64_t) == 0 && d.pairoffset + d.npairs * sizeof(uint64_t) <= len
+			&& d.wideoffset % sizeof(uint64_t) == 0 && d.wideoffset + d.nwide * 2 * sizeof(uint64_t) <= len;
+	}
+	if (!valid)
+	{
+		fprintf(stderr, "%s is not a kmpare index file or is incomplete\n", fname.c_str());
+		indexmap.close();
+		fail = 1;
+		return false;
+	}
+	if (canonical != (head.canonical != 0))
+	{
+		fprintf(stderr, "%s was built %s -canonical and must be analyzed %s it\n", fname.c_str(),
+			head.canonical ? "with" : "without", head.canonical ? "with" : "without");
+		indexmap.close();
+		fail = 1;
+		return false;
+	}
+	if (head.mincount > mincount || head.minlibs > minlibs)
+		fprintf(stderr, "%s was built with -min-count %u -min-libs %u, which are kept\n", fname.c_str(), head.mincount, head.minlibs);
+	mincount = std::max(mincount, head.mincount);
+	minlibs = std::max(minlibs, head.minlibs);
+	ntargets = head.ntargets;
+	indexfiltered = head.mincount > 1 || head.minlibs > 1 || ntargets > 0;
+
+	merlen = head.merlen;
+	nlibs = head.nlibs;
+	libtotal.setSize(head.nlibs);
+	for (i = 0; i < head.nlibs; ++i)
+	{
+		uint64_t total = 0;
+		memcpy(&total, base + sizeof(head) + i * sizeof(uint64_t), sizeof(total));
+		libtotal[i] = total;
+	}
+	datamap.layout(head.nlibs, head.shardbits, head.skipbits, head.countbytes, head.sparse);
+	for (i = 0; i < nshards; ++i)
+	{
+		const IndexShard& d = shards[i];
+		KmerTable<KeyHasher>& table = datamap.shard(i);
+		if (d.capacity == 0)
+			continue;
+		table.attach(head.nlibs, head.skipbits + head.shardbits, head.countbytes, head.sparse, d.capacity, d.size,
+			reinterpret_cast<unsigned char*>(base + d.ctrloffset), reinterpret_cast<uint64_t*>(base + d.slaboffset),
+			reinterpret_cast<const uint64_t*>(base + d.pairoffset), d.npairs);
+		const uint64_t* rec = reinterpret_cast<const uint64_t*>(base + d.wideoffset);
+		for (uint64_t w = 0; w < d.nwide; ++w, rec += 2)
+			table.setCount(rec[0] / head.nlibs, rec[0] % head.nlibs, rec[1]);
+	}
+	ambigseq.clear();
+	ambigid.clear();
+	for (i = 0; i < head.nambig; ++i)
+	{
+		ambigseq.push_back(std::string(base + head.ambigoffset + i * head.merlen, head.merlen));
+		ambigid[ambigseq.back()] = i;
+	}
+	kmertypes = datamap.size();
+	return true;
 }
 
-// parseJellyCounts extracts kmers and counts from Jellyfish files (sets member "counts")
-void kmer::parseJellyCounts (std::vector<std::string>& files)
+// streamJellyCounts handles Jellyfish dumps sorted lexicographically by kmer without a kmer table: a first pass
+// checks the order and sums each library, then all files are merged in step and each kmer's row is scored and
+// written (as text, or to bin if given) as soon as it is complete, so memory use depends only on the number of libraries;
+// with p-values the files are merged once more beforehand to gather the p-values for q-values
+void kmer::streamJellyCounts (std::vector<std::string>& files, std::vector< std::vector<unsigned int> >* set, std::ofstream& os, unsigned int nthreads, ResultWriter* bin)
 {
 	if ( files.empty() )
 	{
-		fprintf(stderr, "No files to parse in call to kmer::parseJellyCounts\n");
+		fprintf(stderr, "No files to parse in call to kmer::streamJellyCounts\n");
 		fail = 1;
 		return;
 	}
+	unsigned int nfiles = files.size();
 	unsigned int lib = 0;
-	unsigned long int filelen = 0;
-	Value<double> seqdat;
-	seqdat.count.setSize(files.size());
-	Key<long int> seqID;
-	int maxdigit = ndigit(std::numeric_limits<long int>::max());
-	std::ifstream is;
-	for (std::vector<std::string>::iterator fIter = files.begin(); fIter != files.end(); ++fIter)
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	// library totals and order check
+	std::vector<LibRun> runs(nfiles);
+	std::atomic<unsigned int> nextlib(0);
+	std::vector<std::thread> workers;
+	for (i = 0; i < std::max(1U, std::min(nthreads, nfiles)); ++i)
+		workers.push_back(std::thread(&kmer::scanSorted, this, &files, &runs, &nextlib));
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	merlen = runs[0].merlen;
+	libtotal.setSize(nfiles);
+	for (lib = 0; lib < nfiles; ++lib)
 	{
-		std::cerr << "reading file: " << *fIter << "\n";
-		is.open(fIter->c_str());
-		if (is.fail())
+		if (runs[lib].fail)
 		{
-				std::cerr << "Could not open file: " << *fIter << "\n";
-				fail = 1;
-				return;
+			fail = 1;
+			return;
 		}
-		if (is.rdbuf()->in_avail() == 0)
+		if (runs[lib].merlen != merlen)
 		{
-			std::cerr << "0 sequences found in file: " << *fIter << "\n";
+			fprintf(stderr, "kmer length %d in %s differs from length %d in the first file\n", runs[lib].merlen, files[lib].c_str(), merlen);
 			fail = 1;
 			return;
 		}
-		int merlen = jellyMerLength(is);
-		fprintf(stderr, "kmer length is %d\n", merlen);
-		int seqparts = ceil(merlen / static_cast<float>(maxdigit));
-		if (lib == 0)
-		{
-			seqID.id.setSize(seqparts);
-			libtotal.setSize(files.size());
-			filelen = estLines (is, merlen, nonseq_char);
-			storage = filelen + filelen * xtra_reserve;
-			seqID.tableSize = &storage;
-			datamap.reserve(storage);
-		}
-		std::string line;
-		std::vector<std::string> tokens;
-		std::pair<countmap::iterator, bool> result;
-		size_t nbuckets = 0;
-		unsigned int i = 0;
-		while (getline(is, line))
-		{
-			if (datamap.size() > datamap.bucket_count())
-			{
-				std::cerr << "Increasing reserve to accommodate additional kmers...\n";
-				nbuckets = datamap.size() + datamap.size() * xtra_reserve;
-				datamap.reserve(nbuckets);
-				storage = nbuckets;
-			}
-			tokens = split(line, ' ');
-			seqdat.count[lib] = (atoi(tokens[1].c_str()));
-			libtotal[lib] += seqdat.count[lib];
-			seqtonum(tokens[0], seqID.id, maxdigit);
-			result = datamap.insert(countmap::value_type(seqID, seqdat));
-			if (result.second == 1)
-			{
-				++kmertypes;
-				for (i = 0; i < lib; ++i)
-					result.first->second.count[i] = 0;
-			}
-                        result.first->second.count[lib] = seqdat.count[lib];
-		}
-		is.close();
-		++lib;
+		libtotal[lib] = runs[lib].total;
 	}
+	reportSkipped();
 
-	/* start debug code
-	std::stringstream debugss;
-	for(countmap::iterator it = datamap.begin(); it != datamap.end(); ++it)
+	std::vector<double*> p(set->size());
+	for (j = 0; j < set->size(); ++j)
+	{
+		p[j] = new double[(*set)[j].size()];
+		libProbs(p[j], &(*set)[j], libtotal);
+	}
+
+	// merge the files in kmer order
+	std::vector<JellyReader> readers(nfiles);
+	std::vector<Key> cur(nfiles);
+	std::vector<unsigned int> curcount(nfiles);
+	std::vector<unsigned int> heap; // min-heap of files keyed on their current kmer
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	struct Later
 	{
-		std::cerr << numtoseq(it->first.id, debugss) << "\t";
-		for (unsigned int j = 0; j < it->second.count.size(); ++j)
+		const std::vector<Key>* cur;
+		bool operator() (unsigned int a, unsigned int b) const
 		{
-			std::cerr << "\t" << it->second.count[j];
+			return (*cur)[b] < (*cur)[a];
+		}
+	} later = {&cur};
+	if (bin && !bin->started())
+		bin->start(merlen, nfiles, set, sizeof(unsigned int));
+	RowWriter out(os, bin ? 0 : rowBufferSize);
+	ScoreBatch batch(set->size(), 0);
+	std::vector<Key> keybuf(gofBatch);
+	std::vector<unsigned int> rowbuf(gofBatch * nfiles);
+	if (top > 0)
+		topstats.init(set->size(), top);
+	for (int pass = ranks() ? 0 : 1; pass < 2 && !fail; ++pass)
+	{
+		heap.clear();
+		for (lib = 0; lib < nfiles; ++lib)
+		{
+			readers[lib].close();
+			if (!readers[lib].open(files[lib].c_str()))
+			{
+				std::cerr << "Could not open file: " << files[lib] << "\n";
+				fail = 1;
+				break;
+			}
+			while (readers[lib].next(seq, seqlen, count))
+			{
+				if (packSeq(seq, seqlen, cur[lib]))
+				{
+					curcount[lib] = count;
+					heap.push_back(lib);
+					std::push_heap(heap.begin(), heap.end(), later);
+					break;
+				}
+			}
 		}
-		std::cerr << "\n";
-	}
-	 end debug code */
-}
-// numtoseq converts a string of numbers to nucleotide letters
-std::string kmer::numtoseq (const Array<long int>& num, std::stringstream& ss) const
-{
-	if (!ss.str().empty())
-		ss.str(std::string());
 
-	unsigned int i = 0;
-	for (i = 0; i < num.size(); ++i)
-		ss << num[i];
-	std::string s( ss.str() );
-	for(i = 0; i < s.length(); ++i)
-	{
-		if (s[i] == '1')
-			s[i] = 'A';
-		else if ( s[i] == '2')
-			s[i] = 'C';
-		else if ( s[i] == '3')
-			s[i] = 'G';
-		else if ( s[i] == '4')
-			s[i] = 'T';
-		else if ( s[i] == '5')
-			s[i] = 'N';
-		else
+		if (pass == 1)
+			setFloors(set->size());
+		std::cerr << (pass == 0 ? "Scoring kmers to rank their statistics...\n" : "Streaming merged kmers to output...\n");
+		while (!heap.empty() && !fail)
+		{
+			Key& key = keybuf[batch.keys.size()];
+			unsigned int* row = &rowbuf[batch.keys.size() * nfiles];
+			key = cur[heap.front()];
+			std::fill(row, row + nfiles, 0);
+			while (!heap.empty() && cur[heap.front()] == key)
+			{
+				lib = heap.front();
+				std::pop_heap(heap.begin(), heap.end(), later);
+				heap.pop_back();
+				row[lib] = curcount[lib];
+				while (readers[lib].next(seq, seqlen, count))
+				{
+					if (packSeq(seq, seqlen, cur[lib]))
+					{
+						curcount[lib] = count;
+						heap.push_back(lib);
+						std::push_heap(heap.begin(), heap.end(), later);
+						break;
+					}
+				}
+			}
+			if (!targeted(key) || !passes(row))
+				continue;
+			batch.keys.push_back(&key);
+			batch.rows.push_back(row);
+			if (batch.keys.size() < gofBatch)
+				continue;
+			if (pass == 0)
+				collectBatch(&batch, &p[0], set);
+			else
+			{
+				kmertypes += batch.keys.size();
+				emitBatch(&batch, &p[0], set, out, bin);
+			}
+		}
+		for (lib = 0; lib < nfiles; ++lib)
+			if (readers[lib].bad())
+				fail = 1;
+		if (fail)
+			break;
+		if (pass == 0)
 		{
-			fprintf(stderr, "WARNING: Unknown value in sequence\n");
-			s[i] = '?';
+			collectBatch(&batch, &p[0], set);
+			finishStats(nthreads);
+			continue;
 		}
+		kmertypes += batch.keys.size();
+		emitBatch(&batch, &p[0], set, out, bin);
+	}
+	out.flush();
+	if (out.fail() || (bin && bin->fail()))
+	{
+		std::cerr << "Could not write output\n";
+		fail = 1;
 	}
 
-	return s;
+	for (j = 0; j < set->size(); ++j)
+		delete [] p[j];
 }
 
-
-
-// seqtonum converts a string to a set of integers
-void kmer::seqtonum (const std::string& s, Array<long int>& num, const int maxdigit)
+// scanSorted sums the counts of libraries and checks that their kmers are in increasing order until none are left
+void kmer::scanSorted (const std::vector<std::string>* files, std::vector<LibRun>* runs, std::atomic<unsigned int>* nextlib) const
 {
-	std::string::const_iterator iter;
-	int i = 0;
-	int j = 0;
-	char charstr [maxdigit];
-	char nuc;
-	for (iter = s.begin(); iter != s.end(); ++iter)
+	unsigned int lib = 0;
+	JellyReader reader;
+	const char* seq = 0;
+	int seqlen = 0;
+	unsigned long int count = 0;
+	Key key;
+	Key last;
+	bool first = true;
+	while ((lib = (*nextlib)++) < files->size())
 	{
-		nuc = toupper(*iter);
-		if (i < maxdigit)
+		const char* file = (*files)[lib].c_str();
+		LibRun& run = (*runs)[lib];
+		fprintf(stderr, "scanning file: %s\n", file);
+		if (!reader.open(file))
 		{
-			if (nuc == 'A')
-				charstr[i] = '1';
-			else if (nuc == 'C')
-				charstr[i] = '2';
-			else if (nuc == 'G')
-				charstr[i] = '3';
-			else if (nuc == 'T')
-				charstr[i] = '4';
-			else if (nuc == 'N')
-				charstr[i] = '5';
-			else
-			{
-				fprintf(stderr, "WARNING: Unknown base found in sequence\n");
-				charstr[i] = '6';
-			}
-			i++;
+			fprintf(stderr, "Could not open file: %s\n", file);
+			run.fail = 1;
+			continue;
 		}
-		else
+		if (!reader.mapped())
+		{
+			fprintf(stderr, "Streaming mode reads every file twice and needs regular files: %s\n", file);
+			run.fail = 1;
+			continue;
+		}
+		run.merlen = reader.merLength();
+		if (run.merlen < 1 || run.merlen > maxMerLength)
+		{
+			fprintf(stderr, "Missing or invalid kmer length in %s\n", file);
+			run.fail = 1;
+			continue;
+		}
+		first = true;
+		while (reader.next(seq, seqlen, count))
 		{
-			num[j] = atol(charstr);
-			i = 0;
-			++j;
-			--iter;
+			if (seqlen != run.merlen)
+			{
+				fprintf(stderr, "kmer %.*s does not have length %d\n", seqlen, seq, run.merlen);
+				run.fail = 1;
+				break;
+			}
+			if (!packSeq(seq, seqlen, key))
+			{
+				// the merge has no order for kmers with ambiguous bases, which other modes keep in a side table
+				if (ambigSpace(seqlen))
+				{
+					fprintf(stderr, "%s holds kmer %.*s with an ambiguous base, which -stream cannot merge (run without -stream)\n",
+						file, seqlen, seq);
+					run.fail = 1;
+					break;
+				}
+				++nskipped;
+				continue;
+			}
+			if (!first && !(last < key))
+			{
+				fprintf(stderr, "%s is not sorted by kmer at %.*s (dump with sorted output)\n", file, seqlen, seq);
+				run.fail = 1;
+				break;
+			}
+			first = false;
+			last = key;
+			run.total += count;
 		}
+		if (reader.bad())
+			run.fail = 1;
+		reader.close();
 	}
-	for (int k = i; k < maxdigit; ++k)
-		charstr[k] = 0;
-	if (i < maxdigit)
-		num[j] = atol(charstr);
 }
 
-// ndigit determines the number of digits in a number
-template <class T> int kmer::ndigit (T number)
+// numtoseq converts a packed kmer back to nucleotide letters
+std::string kmer::numtoseq (const Key& key) const
 {
-	int len = 0;
-	while (number)
-    {
-		++len;
-		number /= 10;
-     }
-    return len;
+	if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+		return ambigseq[key.id[KMER_WORDS - 1] & ~ambigFlag];
+
+	std::string s(merlen, 'N');
+	unpackSeq(key, merlen, &s[0]);
+	return s;
 }
 
-// jellyMerLength determines length of kmers in Jellyfish file
-int kmer::jellyMerLength (std::ifstream& is)
+// seqtonum packs a kmer into a Key, kmers with ambiguous bases are stored in a side table and keyed by their ordinal;
+// one off the target panel is not stored and gets an ordinal past the end of the table, which targeted turns away
+bool kmer::seqtonum (const char* s, Key& key)
 {
-	if (is)
+	if (packKey(s, merlen, key))
+		return true;
+
+	if (!ambigSpace(merlen))
 	{
-		int currentpos = is.tellg();
-		std::string line;
-		while (line.empty())
-		{
-			getline(is, line);
-		}
-		is.seekg(currentpos);
-		int kmerlength = (split(line, ' '))[0].length();
-		return kmerlength;
+		++nskipped;
+		return false;
 	}
-	else
+	std::string seq = ambigText(s, merlen);
+	for (int w = 0; w < KMER_WORDS; ++w)
+		key.id[w] = 0;
+	key.id[0] = ambigFlag;
+	if (!targetedSeq(seq))
 	{
-		fprintf(stderr, "ERROR: No instream to function jellyMerLength\n");
-		return -1;
+		key.id[KMER_WORDS - 1] |= ~ambigFlag;
+		return true;
 	}
+	std::pair<std::unordered_map<std::string, uint64_t>::iterator, bool> result = ambigid.insert(std::make_pair(seq, ambigseq.size()));
+	if (result.second)
+		ambigseq.push_back(seq);
+	key.id[KMER_WORDS - 1] |= result.first->second;
+	return true;
+}
+
+// ambigText returns a kmer with ambiguous bases as the side table keeps it: in upper case and, in canonical mode,
+// folded to the lesser of itself and its reverse complement
+std::string kmer::ambigText (const char* s, int merlength) const
+{
+	std::string seq(s, merlength);
+	for (std::string::iterator iter = seq.begin(); iter != seq.end(); ++iter)
+		*iter = toupper(*iter);
+	if (canonical)
+		canonicalSeq(&seq[0], merlength);
+	return seq;
+}
+
+// packKey packs a kmer of merlength bases into key, folding it to the lesser of itself and its reverse complement
+// in canonical mode; flipped, if given, is set to whether it was the reverse complement that was kept
+bool kmer::packKey (const char* s, int merlength, Key& key, bool* flipped) const
+{
+	if (!packSeq(s, merlength, key))
+		return false;
+	bool rc = canonical && canonicalKey(key, merlength);
+	if (flipped)
+		*flipped = rc;
+	return true;
+}
+
+// lookupKey packs a kmer of merlen bases as the table keys it, finding a kmer with ambiguous bases in the side table
+// without adding it there; returns false for a kmer with ambiguous bases that the table does not hold
+bool kmer::lookupKey (const char* s, Key& key) const
+{
+	if (packKey(s, merlen, key))
+		return true;
+	if (!ambigSpace(merlen))
+		return false;
+	std::string seq = ambigText(s, merlen);
+	std::unordered_map<std::string, uint64_t>::const_iterator found = ambigid.find(seq);
+	if (found == ambigid.end())
+		return false;
+	for (int w = 0; w < KMER_WORDS; ++w)
+		key.id[w] = 0;
+	key.id[0] = ambigFlag;
+	key.id[KMER_WORDS - 1] |= found->second;
+	return true;
+}
+
+// putCount stores a library's count for key, adding it to what is there in canonical mode, where a kmer and its
+// reverse complement in the same library share a row
+void kmer::putCount (const Key& key, unsigned int lib, unsigned int count, bool& added)
+{
+	if (canonical)
+		datamap.addCount(key, lib, count, added);
+	else
+		datamap.setCount(key, lib, count, added);
+}
+
+// jellyMerLength determines length of kmers in Jellyfish file
+int kmer::jellyMerLength (JellyReader& reader)
+{
+	return reader.merLength();
 }
 
-//estLines approximates the number of lines in Jellyfish file
-unsigned long int kmer::estLines (std::ifstream& is, int merlength, const int nonseq_n)
+//estLines approximates the number of lines in a Jellyfish file of nbytes bytes
+unsigned long int kmer::estLines (size_t nbytes, int merlength, const int nonseq_n)
 {
 	if (merlength <= 0)
 	{
 		fprintf(stderr, "ERROR: Invalid kmer length in estLines function");
 		return -1;
 	}
-	if (is)
-	{
-		unsigned long int currentpos = is.tellg();
-		is.seekg(0, is.end);
-		unsigned long int length = is.tellg();
-		is.seekg(currentpos);
-		return ceil((length/static_cast<double>((merlength + nonseq_n*sizeof(char)))));
-	}
-	else
-	{
-		fprintf(stderr, "ERROR: No instream to function estLines\n");
-		return -1;
-	}
+	return ceil((nbytes/static_cast<double>((merlength + nonseq_n*sizeof(char)))));
 }
 
 
@@ -289,102 +1969,428 @@ void kmer::libProbs (double p [], std::vector<unsigned int>* idx, Array<size_t>&
 	}
 }
 
-// calculates goodness-of-fit statistic using a weighted average as the expected value
-template <class T> double kmer::calcWGOF (double p [], const Array<T>& obs, std::vector<unsigned int>* idx)
+// fit scores each kmer against every library set and prints its row as soon as it is scored, as text or to bin if given;
+// with more than one thread, ranges of table slots are scored in parallel and written in the order a single thread would
+void kmer::fit (std::ofstream& os, const countmap* data, std::vector< std::vector<unsigned int> >* set, ResultWriter* bin, unsigned int nthreads)
+{
+	if (data->size() < 1)
+	{
+		fprintf(stderr, "No elements in kmer hash in call to kmer::fit\n");
+		fail = 1;
+		return;
+	}
+	unsigned int j = 0;
+
+	std::vector<double*> p(set->size()); // P(kmer comes from library i)
+	for (j = 0; j < set->size(); ++j)
+	{
+		p[j] = new double[(*set)[j].size()];
+		libProbs(p[j], &(*set)[j], libtotal);
+	}
+
+	setFloors(set->size());
+	std::cerr << "Calculating and printing goodness-of-fit statistics (" << gofKernelName() << " kernel)...\n";
+	if (bin && !bin->started())
+		bin->start(merlen, libtotal.size(), set, countWidth(data));
+	RowWriter out(os, bin ? 0 : rowBufferSize);
+	if (nthreads <= 1)
+	{
+		ScoreBatch batch(set->size(), data->nlibs());
+		for (countmap::const_iterator datIter = data->begin(); datIter != data->end() && !fail; ++datIter)
+		{
+			unsigned int* row = &batch.counts[batch.keys.size() * data->nlibs()];
+			datIter.row(row);
+			if (!passes(row))
+				continue;
+			batch.keys.push_back(&datIter.key());
+			batch.rows.push_back(row);
+			if (batch.keys.size() == gofBatch)
+				emitBatch(&batch, &p[0], set, out, bin);
+		}
+		emitBatch(&batch, &p[0], set, out, bin);
+	}
+	else
+	{
+		// split the table into slot ranges, score them on a pool of threads, and write them in table order
+		std::vector<FitChunk> chunks;
+		for (size_t shard = 0; shard < data->nshards(); ++shard)
+		{
+			size_t cap = data->shard(shard).capacity();
+			for (size_t begin = 0; begin < cap; begin += fitChunkSlots)
+			{
+				chunks.push_back(FitChunk());
+				chunks.back().shard = shard;
+				chunks.back().begin = begin;
+				chunks.back().end = std::min(cap, begin + fitChunkSlots);
+			}
+		}
+		FitOrder order;
+		order.window = 2 * nthreads;
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < nthreads; ++t)
+			workers.push_back(std::thread(&kmer::fitChunks, this, data, &p[0], set, &chunks, &order, bin != 0));
+		for (size_t c = 0; c < chunks.size(); ++c)
+		{
+			FitChunk& chunk = chunks[c];
+			{
+				std::unique_lock<std::mutex> lock(order.mutex);
+				order.cond.wait(lock, [&chunk] { return chunk.done; });
+			}
+			if (!bin)
+			{
+				out.put(chunk.text.data(), chunk.text.size());
+				out.flush();
+			}
+			for (size_t r = 0; bin && r < chunk.keys.size() && !fail; ++r)
+			{
+				const Key& key = *chunk.keys[r];
+				const char* ambig = 0;
+				if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+					ambig = ambigseq[key.id[KMER_WORDS - 1] & ~ambigFlag].data();
+				if (!bin->add(key, ambig, &chunk.counts[r * data->nlibs()], &chunk.stats[r * statColumns(set->size())]))
+					fail = 1;
+			}
+			chunk = FitChunk();
+			std::lock_guard<std::mutex> lock(order.mutex);
+			++order.written;
+			order.cond.notify_all();
+		}
+		for (size_t t = 0; t < workers.size(); ++t)
+			workers[t].join();
+	}
+	out.flush();
+	if (out.fail() || (bin && bin->fail()))
+	{
+		std::cerr << "Could not write output\n";
+		fail = 1;
+	}
+
+	// deallocate space for probability vector
+	for (j = 0; j < set->size(); ++j)
+		delete [] p[j];
+}
+
+// scoreBatch computes the fit of each row in batch to each library set, and its p-value if they are wanted; warn
+// reports rows with zero expectation, which a second pass over the same rows leaves off
+void kmer::scoreBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set, bool warn) const
+{
+	size_t n = batch->keys.size();
+	size_t r = 0;
+	unsigned int i = 0;
+	for (unsigned int j = 0; j < set->size(); ++j)
+	{
+		const std::vector<unsigned int>& libs = (*set)[j];
+		batch->obs.resize(libs.size() * gofBatch);
+		for (i = 0; i < libs.size(); ++i)
+			for (r = 0; r < n; ++r)
+				batch->obs[i * gofBatch + r] = batch->rows[r][libs[i]];
+		size_t nzero = batch->kernel(&batch->obs[0], gofBatch, n, p[j], libs.size(), &batch->stats[j * gofBatch]);
+		for (; warn && nzero > 0; --nzero)
+			fprintf(stderr, "WARNING: Division by zero in calcGOF\n");
+		if (pvalues)
+			chiSquareUpper(&batch->stats[j * gofBatch], n, libs.size() - 1, &batch->pvals[j * gofBatch]);
+	}
+}
+
+// emitBatch scores the rows in batch against each library set, writes those selected as text to out or to bin if given, and empties batch
+void kmer::emitBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set, RowWriter& out, ResultWriter* bin)
 {
-	double stat = 0.0;
-	double expt = 0;
-	T obs_total = arraySum(obs, idx);
+	size_t n = batch->keys.size();
+	size_t r = 0;
 	unsigned int i = 0;
-	for (std::vector<unsigned int>::const_iterator iter = idx->begin(); iter != idx->end(); ++iter)
+	scoreBatch(batch, p, set);
+	for (r = 0; r < n && !fail; ++r)
 	{
-		expt = p[i] * obs_total;
-		if (expt != 0)
-			stat += pow((obs[*iter] - expt), 2) / expt;
+		if (!selects(&batch->stats[r], gofBatch))
+			continue;
+		const Key& key = *batch->keys[r];
+		const char* ambig = 0;
+		if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+			ambig = ambigseq[key.id[KMER_WORDS - 1] & ~ambigFlag].data();
+		if (bin)
+		{
+			for (unsigned int j = 0; j < set->size(); ++j)
+				batch->row[j] = batch->stats[j * gofBatch + r];
+			for (unsigned int j = 0; pvalues && j < set->size(); ++j)
+			{
+				batch->row[set->size() + j] = batch->pvals[j * gofBatch + r];
+				batch->row[2 * set->size() + j] = qvalues.lookup(j, batch->pvals[j * gofBatch + r]);
+			}
+			if (!bin->add(key, ambig, batch->rows[r], &batch->row[0]))
+				fail = 1;
+			continue;
+		}
+		if (ambig)
+			out.put(ambig, merlen);
 		else
 		{
-			fprintf(stderr, "WARNING: Division by zero in calcGOF\n");
-			return 1.0/0.0;
+			unpackSeq(key, merlen, out.room(merlen));
+			out.advance(merlen);
 		}
-		++i;
+		for (i = 0; i < libtotal.size(); ++i)
+		{
+			out.put('\t');
+			out.putCount(batch->rows[r][i], 12);
+		}
+		for (unsigned int j = 0; j < set->size(); ++j)
+		{
+			out.put('\t');
+			out.putStat(batch->stats[j * gofBatch + r], 12, 5);
+		}
+		for (unsigned int j = 0; pvalues && j < set->size(); ++j)
+		{
+			out.put('\t');
+			out.putStat(batch->pvals[j * gofBatch + r], 12, 5);
+		}
+		for (unsigned int j = 0; pvalues && j < set->size(); ++j)
+		{
+			out.put('\t');
+			out.putStat(qvalues.lookup(j, batch->pvals[j * gofBatch + r]), 12, 5);
+		}
+		out.put('\n');
 	}
-	return stat;
+	batch->keys.clear();
+	batch->rows.clear();
 }
 
-// calculates goodness-of-fit for a set of kmer counts and stores them in a MemPool<double> object
-void kmer::fit(countmap* data, MemPool<double>* stats, std::vector< std::vector<unsigned int> >* set)
+// queryKmers writes to out the text output row of each kmer in seqs scored against set, with zero counts for a kmer
+// the table does not hold, or a line starting "error:" for one that cannot be looked up
+void kmer::queryKmers (const std::vector<std::string>& seqs, std::vector< std::vector<unsigned int> >* set, RowWriter& out)
 {
+	if (seqs.empty())
+		return;
 	unsigned int j = 0;
-
-	double* p [set->size()]; // P(kmer comes from library i)
+	unsigned int n = datamap.nlibs();
+	std::vector<double*> p(set->size());
 	for (j = 0; j < set->size(); ++j)
 	{
 		p[j] = new double[(*set)[j].size()];
 		libProbs(p[j], &(*set)[j], libtotal);
 	}
+	ScoreBatch batch(set->size(), n);
+	std::vector<Key> keys(gofBatch);
+	for (size_t i = 0; i < seqs.size(); ++i)
+	{
+		const std::string& s = seqs[i];
+		Key& key = keys[batch.keys.size()];
+		unsigned int* row = &batch.counts[batch.keys.size() * n];
+		const char* why = static_cast<int>(s.size()) != merlen ? "is not of the kmer length"
+			: !lookupKey(s.data(), key) ? "has ambiguous bases and is not in the table" : 0;
+		if (why)
+		{
+			emitBatch(&batch, &p[0], set, out, 0);
+			out.put("error: ", 7);
+			out.put(s.data(), s.size());
+			out.put(' ');
+			out.put(why, strlen(why));
+			out.put('\n');
+			continue;
+		}
+		if (!datamap.find(key, row))
+			std::fill(row, row + n, 0);
+		batch.keys.push_back(&key);
+		batch.rows.push_back(row);
+		if (batch.keys.size() == gofBatch)
+			emitBatch(&batch, &p[0], set, out, 0);
+	}
+	emitBatch(&batch, &p[0], set, out, 0);
+	for (j = 0; j < set->size(); ++j)
+		delete [] p[j];
+}
+
+// ranks tells whether every kmer must be scored before any is written, for q-values or for top
+bool kmer::ranks () const
+{
+	return pvalues || top > 0;
+}
 
-	// allocate storage for GOF statistics
-	std::cerr << "Allocating space for goodness-of-fit statistics...\n";
-	if (stats->initial() == 1)
+// collectStats scores every kmer in data on nthreads threads and keeps the p-values for q-values and the highest
+// statistics for top; it is called on each table of the run, before finishStats and before any output
+void kmer::collectStats (const countmap* data, std::vector< std::vector<unsigned int> >* set, unsigned int nthreads)
+{
+	unsigned int j = 0;
+	if (top > 0 && topstats.sets() != set->size())
+		topstats.init(set->size(), top);
+	std::vector<double*> p(set->size());
+	for (j = 0; j < set->size(); ++j)
+	{
+		p[j] = new double[(*set)[j].size()];
+		libProbs(p[j], &(*set)[j], libtotal);
+	}
+	std::cerr << "Scoring kmers to rank their statistics...\n";
+	std::vector<FitChunk> chunks;
+	for (size_t shard = 0; shard < data->nshards(); ++shard)
 	{
-		std::cerr << "WARNING: memPool object supplied to kmer::fit already initialized --> clearing content\n";
-		stats->deleteReserve();
+		size_t cap = data->shard(shard).capacity();
+		for (size_t begin = 0; begin < cap; begin += fitChunkSlots)
+		{
+			chunks.push_back(FitChunk());
+			chunks.back().shard = shard;
+			chunks.back().begin = begin;
+			chunks.back().end = std::min(cap, begin + fitChunkSlots);
+		}
 	}
-	stats->formatReserve((kmertypes * set->size()), 0);
+	std::atomic<size_t> nextchunk(0);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < std::max(1U, nthreads); ++t)
+		workers.push_back(std::thread(&kmer::collectChunks, this, data, &p[0], set, &chunks, &nextchunk));
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+	for (j = 0; j < set->size(); ++j)
+		delete [] p[j];
+}
 
-	// assign GOF values to memPool buffer
-	std::cerr << "Calculating goodness-of-fit statistics...\n";
-	node* curr_node = stats->headNode();
-	char* buf_loc = 0;
-	double* val = 0;
-	size_t i = 0;
-	size_t block = 1;
-	for(countmap::iterator datIter = data->begin(); datIter != data->end(); ++datIter)
+// finishStats ranks the collected p-values so q-values can be looked up
+void kmer::finishStats (unsigned int nthreads)
+{
+	if (!pvalues)
+		return;
+	std::cerr << "Ranking p-values...\n";
+	qvalues.finish(std::max(1U, nthreads));
+}
+
+// collectChunks scores chunks of the table until none are left, keeping only what collectBatch keeps
+void kmer::collectChunks (const countmap* data, double* p [], std::vector< std::vector<unsigned int> >* set, const std::vector<FitChunk>* chunks,
+	std::atomic<size_t>* nextchunk)
+{
+	ScoreBatch batch(set->size(), data->nlibs());
+	size_t c = 0;
+	while ((c = (*nextchunk)++) < chunks->size())
 	{
-		for (j = 0; j < set->size(); ++j)
+		const FitChunk& chunk = (*chunks)[c];
+		const KmerTable<KeyHasher>& table = data->shard(chunk.shard);
+		for (size_t slot = chunk.begin; slot < chunk.end; ++slot)
 		{
-			buf_loc = curr_node->buf + sizeof(double) * i;
-			val = reinterpret_cast<double*> (buf_loc);
-			*val = calcWGOF(p[j], datIter->second.count, &(*set)[j]);
-			++i;
-			if (i >= stats->blockSize())
+			if (table.full(slot))
 			{
-				++block;
-				if (block <= stats->nBlocks())
+				unsigned int* row = &batch.counts[batch.keys.size() * data->nlibs()];
+				table.row(slot, row);
+				if (passes(row))
 				{
-					curr_node = curr_node->next;
-					buf_loc = curr_node->buf;
-					i = 0;
+					batch.keys.push_back(&table.key(slot));
+					batch.rows.push_back(row);
 				}
 			}
+			if (batch.keys.size() == gofBatch)
+				collectBatch(&batch, p, set);
 		}
 	}
+	collectBatch(&batch, p, set);
+}
 
-	// deallocate space for probability vector
-	for (j = 0; j < set->size(); ++j)
-		delete [] p[j];
+// collectBatch scores the rows in batch, keeps their p-values and offers their statistics to topstats, and empties batch
+void kmer::collectBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set)
+{
+	scoreBatch(batch, p, set, false);
+	for (unsigned int j = 0; pvalues && j < set->size(); ++j)
+		qvalues.add(j, &batch->pvals[j * gofBatch], batch->keys.size());
+	for (unsigned int j = 0; top > 0 && j < set->size(); ++j)
+		topstats.add(j, &batch->stats[j * gofBatch], batch->keys.size());
+	batch->keys.clear();
+	batch->rows.clear();
 }
 
+// setFloors fixes the least statistic for each of nsets sets that gets a kmer written, the greater of minstat and
+// the top-th highest statistic collected for the set; it leaves statfloor empty when every kmer is written
+void kmer::setFloors (size_t nsets)
+{
+	const double lowest = -std::numeric_limits<double>::infinity();
+	statfloor.clear();
+	if (top == 0 && minstat == lowest)
+		return;
+	for (size_t j = 0; j < nsets; ++j)
+		statfloor.push_back(std::max(minstat, top > 0 ? topstats.least(j) : lowest));
+}
 
-// clear and deallocates "stat" member
-bool kmer::clearStat ()
+// selects tells whether the kmer whose statistic for set j is stats[j * stride] reaches the floor of some set
+bool kmer::selects (const double stats [], size_t stride) const
 {
-	if (stat != 0)
-	{
-		for (unsigned int i = 0; i < statsize; ++i)
-			delete [] stat[i];
-		delete [] stat;
-		stat = 0;
-		statsize = 0;
+	if (statfloor.empty())
 		return true;
-	}
-	else
+	for (size_t j = 0; j < statfloor.size(); ++j)
+		if (stats[j * stride] >= statfloor[j])
+			return true;
+	return false;
+}
+
+// statColumns is the number of values written per kmer for nsets library sets
+size_t kmer::statColumns (size_t nsets) const
+{
+	return pvalues ? 3 * nsets : nsets;
+}
+
+// fitChunks scores chunks of the table until none are left, staying within the window of chunks waiting to be written;
+// text rows are formatted in the chunk, selected binary rows keep their statistics for the writer
+void kmer::fitChunks (const countmap* data, double* p [], std::vector< std::vector<unsigned int> >* set, std::vector<FitChunk>* chunks, FitOrder* order, bool binary)
+{
+	ScoreBatch batch(set->size(), data->nlibs());
+	size_t nsets = set->size();
+	size_t c = 0;
+	size_t r = 0;
+	unsigned int j = 0;
+	while (true)
 	{
-		fprintf(stderr, "WARNING: member stat is already empty\n");
-		return false;
+		{
+			std::unique_lock<std::mutex> lock(order->mutex);
+			order->cond.wait(lock, [order, chunks] { return order->next >= chunks->size() || order->next < order->written + order->window; });
+			if (order->next >= chunks->size())
+				return;
+			c = order->next++;
+		}
+		FitChunk& chunk = (*chunks)[c];
+		const KmerTable<KeyHasher>& table = data->shard(chunk.shard);
+		for (size_t slot = chunk.begin; slot < chunk.end; ++slot)
+		{
+			if (table.full(slot))
+			{
+				unsigned int* row = &batch.counts[batch.keys.size() * data->nlibs()];
+				table.row(slot, row);
+				if (passes(row))
+				{
+					batch.keys.push_back(&table.key(slot));
+					batch.rows.push_back(row);
+				}
+			}
+			if (batch.keys.size() < gofBatch && slot + 1 < chunk.end)
+				continue;
+			if (!binary)
+			{
+				emitBatch(&batch, p, set, chunk.text, 0);
+				continue;
+			}
+			scoreBatch(&batch, p, set);
+			for (r = 0; r < batch.keys.size(); ++r)
+			{
+				if (!selects(&batch.stats[r], gofBatch))
+					continue;
+				chunk.keys.push_back(batch.keys[r]);
+				chunk.counts.insert(chunk.counts.end(), batch.rows[r], batch.rows[r] + data->nlibs());
+				for (j = 0; j < nsets; ++j)
+					chunk.stats.push_back(batch.stats[j * gofBatch + r]);
+				for (j = 0; pvalues && j < nsets; ++j)
+					chunk.stats.push_back(batch.pvals[j * gofBatch + r]);
+				for (j = 0; pvalues && j < nsets; ++j)
+					chunk.stats.push_back(qvalues.lookup(j, batch.pvals[j * gofBatch + r]));
+			}
+			batch.keys.clear();
+			batch.rows.clear();
+		}
+		std::lock_guard<std::mutex> lock(order->mutex);
+		chunk.done = true;
+		order->cond.notify_all();
 	}
 }
 
+// countWidth returns the fewest bytes (1, 2, or 4) that hold every count in data
+unsigned int kmer::countWidth (const countmap* data) const
+{
+	unsigned int most = 0;
+	for (countmap::const_iterator it = data->begin(); it != data->end(); ++it)
+		for (unsigned int i = 0; i < data->nlibs(); ++i)
+			most = std::max(most, it.count(i));
+	return most <= 0xff ? 1 : most <= 0xffff ? 2 : 4;
+}
+
 // printCounts prints kmers and counts
 void kmer::printCounts (std::ofstream& os, const countmap* kmers) const
 {
@@ -394,12 +2400,11 @@ void kmer::printCounts (std::ofstream& os, const countmap* kmers) const
 		fail = 1;
 		return;
 	}
-	std::stringstream seqstream;
 	for (countmap::const_iterator kIter = kmers->begin(); kIter != kmers->end(); ++kIter)
 	{
-		os << numtoseq(kIter->first.id, seqstream);
-		for (unsigned int k = 0; k < kIter->second.count.size(); ++k)
-			os << "\t" << std::setw(12) << std::right << kIter->second.count[k];
+		os << numtoseq(kIter.key());
+		for (unsigned int k = 0; k < kmers->nlibs(); ++k)
+			os << "\t" << std::setw(12) << std::right << kIter.count(k);
 	}
 	os << "\n";
 }
@@ -408,3 +2413,38 @@ size_t kmer::nkmers ()
 {
 	return kmertypes;
 }
+
+// sameCounts checks that other holds the same kmers, counts, and library totals
+bool kmer::sameCounts (const kmer& other) const
+{
+	if (merlen != other.merlen || datamap.size() != other.datamap.size() || libtotal.size() != other.libtotal.size())
+		return false;
+	unsigned int lib = 0;
+	for (lib = 0; lib < libtotal.size(); ++lib)
+	{
+		if (libtotal[lib] != other.libtotal[lib])
+			return false;
+	}
+	Key key;
+	std::vector<unsigned int> row(datamap.nlibs() + 1);
+	for (countmap::const_iterator it = datamap.begin(); it != datamap.end(); ++it)
+	{
+		key = it.key();
+		if (ambigSpace(merlen) && (key.id[0] & ambigFlag))
+		{
+			// ambiguous kmers are numbered in the order each object saw them
+			std::unordered_map<std::string, uint64_t>::const_iterator amb = other.ambigid.find(numtoseq(key));
+			if (amb == other.ambigid.end())
+				return false;
+			key.id[KMER_WORDS - 1] = (key.id[KMER_WORDS - 1] & ambigFlag) | amb->second;
+		}
+		if (!other.datamap.find(key, &row[0]))
+			return false;
+		for (lib = 0; lib < datamap.nlibs(); ++lib)
+		{
+			if (row[lib] != it.count(lib))
+				return false;
+		}
+	}
+	return true;
+}
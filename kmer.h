@@ -13,7 +13,26 @@
 #include <streambuf>
 #include <sstream>
 #include <iomanip>
-#include "memPool.h"
+#include <ctime>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "packedKey.h"
+#include "kmerHash.h"
+#include "kmerTable.h"
+#include "shardTable.h"
+#include "shardQueue.h"
+#include "jellyReader.h"
+#include "libRuns.h"
+#include "rowWriter.h"
+#include "resultFile.h"
+#include "gofKernel.h"
+#include "hyperLogLog.h"
+#include "countFilter.h"
+#include "pValues.h"
+#include "topStats.h"
+#include "kmerIndex.h"
+#include "targetSet.h"
 
 template <class T>
 class Array
@@ -41,6 +60,7 @@ public:
 
         void setSize(size_t size)
         {
+				delete [] data;
 				sz = size;
                 data = new T[size];
                 for(unsigned int long i = 0; i < size; ++i)
@@ -77,44 +97,78 @@ private:
         size_t sz;
 };
 
-template <class T>
-struct Value
+typedef ShardedTable<KeyHasher> countmap;
+
+const size_t parseChunk = 1 << 26; // bytes of input per parser work item in sharded ingest
+const size_t countSample = 1 << 16; // lines read from each input to pick the width of stored counts
+const size_t spillBuffer = 1 << 16; // records buffered per partition before writing
+
+// SpillRec is one (kmer, library, count) record in an out-of-core partition file
+struct SpillRec
 {
-	Array<unsigned int> count;
-	T* data;
+	Key key;
+	unsigned int lib;
+	unsigned int count;
 };
 
-template <class T>
-struct Key
+// ScoreBatch holds up to gofBatch rows whose goodness-of-fit is computed together
+struct ScoreBatch
 {
-	Array<T> id;
-	size_t* tableSize;
-
-	bool operator==(const Key<T>& a) const
+	ScoreBatch (size_t nsets, unsigned int nlibs)
+		: counts(gofBatch * nlibs),
+		  row(3 * nsets),
+		  stats(nsets * gofBatch),
+		  pvals(nsets * gofBatch),
+		  kernel(gofKernel())
 	{
-		for(size_t i = 0; i < id.size(); ++i)
-		{
-			if (id[i] != a.id[i])
-				return false;
-		}
-		return true;
+		keys.reserve(gofBatch);
+		rows.reserve(gofBatch);
 	}
+	std::vector<const Key*> keys;
+	std::vector<const unsigned int*> rows; // library counts of each kmer
+	std::vector<unsigned int> counts; // gofBatch rows of nlibs counts, for rows copied out of a table
+	std::vector<unsigned int> obs; // counts of the libraries in one set, library-major
+	std::vector<double> row; // one kmer's statistics, then p-values and q-values if wanted
+	std::vector<double> stats; // stats[j * gofBatch + r] is the fit of row r to set j
+	std::vector<double> pvals; // pvals[j * gofBatch + r] is its p-value, when p-values are wanted
+	GofKernel kernel;
 };
 
-template <class T>
-struct KeyHasher
+const size_t fitChunkSlots = 1 << 15; // table slots scored as one unit by a fit thread
+
+// FitChunk is a range of table slots scored by one thread, whose rows are held until they can be written in table order
+struct FitChunk
 {
-	size_t operator() (const Key<T>& key) const
-	{
-		const int r = 31;
-		unsigned long int h = 0;
-		for(size_t i = 0; i < key.id.size(); ++i)
-			h = (r * h + key.id[i]) % *(key.tableSize);
-		return h;
-	}
+	FitChunk ()
+		: shard(0),
+		  begin(0),
+		  end(0),
+		  done(false)
+	{ }
+	size_t shard;
+	size_t begin;
+	size_t end;
+	RowWriter text; // formatted rows, for text output
+	std::vector<const Key*> keys; // rows and their statistics, for binary output
+	std::vector<unsigned int> counts; // counts[r * nlibs + i] is row r's count in library i
+	std::vector<double> stats; // row r's statistics for the sets, then p-values and q-values if wanted
+	bool done;
 };
 
-typedef std::unordered_map< Key<long int>, Value<double>, KeyHasher<long int> > countmap;
+// FitOrder hands out chunks to fit threads, at most window chunks ahead of the next one to be written
+struct FitOrder
+{
+	FitOrder ()
+		: next(0),
+		  written(0),
+		  window(1)
+	{ }
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t next; // next chunk to score
+	size_t written; // chunks already written
+	size_t window;
+};
 
 class kmer
 {
@@ -122,87 +176,160 @@ public:
 	//public functions
 	kmer ();
 	~kmer ();
-	bool clearStat ();
 	void parseJellyCounts (std::vector<std::string>& files);
-	int jellyMerLength (std::ifstream& is);
-	unsigned int long estLines (std::ifstream& is, int merlength, const int nonseq_n);
-	std::string numtoseq (const Array<long int>& num, std::stringstream& ss) const;
-	void fit(countmap* data, MemPool<double>* stats, std::vector< std::vector<unsigned int> >* set);
-	template <class T> double calcWGOF (double p [], const Array<T>& obs, std::vector<unsigned int>* idx);
+	void parseJellyParallel (std::vector<std::string>& files, unsigned int nthreads);
+	void parseJellySharded (std::vector<std::string>& files, unsigned int nthreads, int shardbits);
+	void parseJellyAtomic (std::vector<std::string>& files, unsigned int nthreads);
+	int jellyMerLength (JellyReader& reader);
+	unsigned int long estLines (size_t nbytes, int merlength, const int nonseq_n);
+	std::string numtoseq (const Key& key) const;
+	void fit (std::ofstream& os, const countmap* data, std::vector< std::vector<unsigned int> >* set, ResultWriter* bin = 0, unsigned int nthreads = 1);
 	template <class T> T arraySum (const Array<T>& v, std::vector<unsigned int>* index);
 	void printCounts (std::ofstream& os, const countmap* kmers) const;
-	template <class T> void printStats (std::ofstream& os, const countmap* kmers, size_t nstats, const MemPool<T>* stats) const;
 	size_t nkmers ();
+	bool sameCounts (const kmer& other) const;
+	size_t estimateKmers (const std::vector<std::string>& files);
+	bool sketchKmers (const std::vector<std::string>& files, unsigned int nthreads);
+	bool buildFilter (const std::vector<std::string>& files, unsigned int nthreads);
+	void clearFilter ();
+	unsigned int countBytes (const std::vector<std::string>& files);
+	size_t memoryEstimate (size_t nkeys, unsigned int nfiles) const;
+	bool spillPartitions (std::vector<std::string>& files, int partbits, const std::string& prefix, std::vector<std::string>* parts);
+	bool loadPartition (const std::string& part, int partbits);
+	bool saveIndex (const std::string& fname) const;
+	bool loadIndex (const std::string& fname);
+	void appendLibraries (std::vector<std::string>& files);
+	bool loadTargets (const std::string& fname, const std::vector<std::string>& files);
+	void queryKmers (const std::vector<std::string>& seqs, std::vector< std::vector<unsigned int> >* set, RowWriter& out);
+	void streamJellyCounts (std::vector<std::string>& files, std::vector< std::vector<unsigned int> >* set, std::ofstream& os, unsigned int nthreads, ResultWriter* bin = 0);
+	template <class H> void probeStats (const char* name) const;
+	bool ranks () const;
+	void collectStats (const countmap* data, std::vector< std::vector<unsigned int> >* set, unsigned int nthreads);
+	void finishStats (unsigned int nthreads);
 	// public data members
 	mutable int fail;
-	double** stat;
-	size_t statsize;
+	unsigned int tablebytes; // bytes per count in the kmer table (1, 2, or 4), 0 to pick from a sample of the input
+	unsigned int mincount; // only kmers whose counts over all libraries sum to at least this are kept (0 or 1 keeps all)
+	unsigned int minlibs; // only kmers found in at least this many libraries are kept (0 or 1 keeps all)
+	bool pvalues; // write each statistic's chi-square p-value and its Benjamini-Hochberg q-value over all kmers
+	size_t top; // only kmers whose statistic for some set is among the top highest for that set are written (0 writes all)
+	double minstat; // only kmers whose statistic for some set is at least this are written (-infinity writes all)
+	bool canonical; // fold each kmer to the lesser of itself and its reverse complement, adding their counts
+	int sparse; // store count rows as (library, count) pairs with merge ingest: 1 always, 0 never, -1 when that at least halves the table
 	countmap datamap; // kmer-specific library counts
-	Array<size_t> libtotal; // library-specific total counts across all kmers
-	size_t kmerN;
+	Array<size_t> libtotal; // library-specific total counts across all kmers the table can hold, kept by the filters or not
 private:
 	//private functions
-	void seqtonum (const std::string& s, Array<long int>& num, const int maxdigit);
-	template <class T> int ndigit (T number);
+	bool seqtonum (const char* s, Key& key);
+	bool readLibrary (JellyReader& reader, unsigned int lib);
+	std::string ambigText (const char* s, int merlength) const;
+	bool packKey (const char* s, int merlength, Key& key, bool* flipped = 0) const;
+	bool lookupKey (const char* s, Key& key) const;
+	void putCount (const Key& key, unsigned int lib, unsigned int count, bool& added);
+	void parseRuns (const std::vector<std::string>* files, std::vector<LibRun>* runs, std::atomic<unsigned int>* nextlib) const;
+	void parseRun (const char* file, LibRun* run) const;
+	void mergeRuns (const std::vector<LibRun>* runs, const std::vector< std::vector<size_t> >* bounds, std::atomic<unsigned int>* nextrange,
+		std::vector<size_t>* nkeys, std::vector< std::vector<uint64_t> >* deferred, const std::vector<size_t>* pairat);
+	bool planChunks (const std::vector<std::string>& files, std::vector<ChunkWork>* work, std::vector<JellyReader*>* streams, size_t* upper);
+	void parseChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, const std::vector<JellyReader*>* streams,
+		std::atomic<size_t>* nextwork, std::vector<ShardQueue>* queues, ParserState* state);
+	void collectParsers (std::vector<ParserState>& parsers);
+	void fillShard (size_t shard, ShardQueue* queue);
+	bool mapChunks (const std::vector<std::string>& files, std::vector<ChunkWork>* work) const;
+	void filterChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, std::atomic<size_t>* nextwork, std::atomic<int>* bad);
+	bool mayPass (const Key& key) const;
+	bool targeted (const Key& key) const;
+	bool targetedSeq (const std::string& seq) const;
+	void reportSkipped ();
+	size_t targetCap (size_t n) const;
+	bool passes (const unsigned int row []) const;
+	void sketchChunks (const std::vector<std::string>* files, const std::vector<ChunkWork>* work, std::atomic<size_t>* nextwork,
+		HyperLogLog* sketch, std::atomic<int>* bad) const;
+	void scanSorted (const std::vector<std::string>* files, std::vector<LibRun>* runs, std::atomic<unsigned int>* nextlib) const;
 	void libProbs (double p [], std::vector<unsigned int>* idx, Array<size_t>& lib_count);
+	unsigned int countWidth (const countmap* data) const;
+	void scoreBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set, bool warn = true) const;
+	void fitChunks (const countmap* data, double* p [], std::vector< std::vector<unsigned int> >* set, std::vector<FitChunk>* chunks, FitOrder* order, bool binary);
+	void collectBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set);
+	void collectChunks (const countmap* data, double* p [], std::vector< std::vector<unsigned int> >* set, const std::vector<FitChunk>* chunks,
+		std::atomic<size_t>* nextchunk);
+	size_t statColumns (size_t nsets) const;
+	void setFloors (size_t nsets);
+	bool selects (const double stats [], size_t stride) const;
+	void emitBatch (ScoreBatch* batch, double* p [], std::vector< std::vector<unsigned int> >* set, RowWriter& out, ResultWriter* bin);
 	// private data members
 	const int nonseq_char; // number of characters in each jellyfish file line, excluding the kmer, for estimating file size
 	const float xtra_reserve; // allocates #_lines_in_1st_file * xtra_reserve more space for member "counts"
 	unsigned int nlibs; // number of libraries to analyze
 	size_t kmertypes; // number of actual different kmers in dataset
 	size_t storage; // number of potential different kmer types to accommodate
+	bool presized; // storage was set by sketchKmers and covers every input file
+	CountFilter countfilter; // bounds each kmer's total count, for mincount
+	CountFilter libfilter; // bounds the number of libraries holding each kmer, for minlibs
+	TargetSet targets; // the only kmers loaded, when loadTargets was given a panel
+	QValues qvalues; // p-values of every kmer, for q-values
+	TopStats topstats; // highest statistics of each set, for top
+	std::vector<double> statfloor; // least statistic for each set that gets a kmer written, empty when all are written
+	int merlen; // length of kmers in dataset
+	IndexMap indexmap; // index file the kmer table is attached to after loadIndex
+	bool indexfiltered; // the index given to loadIndex was built with mincount or minlibs above 1, or with a target panel
+	size_t ntargets; // kmers on the target panel of loadTargets or of the index given to loadIndex, 0 without one
+	mutable std::atomic<size_t> nskipped; // kmers with ambiguous bases dropped for want of room to mark them, until reportSkipped
+	std::vector<std::string> ambigseq; // kmers with ambiguous bases, indexed by the ordinal stored in their Key
+	std::unordered_map<std::string, uint64_t> ambigid; // ordinal of each kmer with ambiguous bases
 };
 
-// printStats prints kmers, counts, and additional information
-template <class T> void kmer::printStats (std::ofstream& os, const countmap* kmers, size_t nstats, const MemPool<T>* stats) const
+// probeStats reinserts the dataset's kmers into a table hashed with H and reports the probe-length distribution
+template <class H> void kmer::probeStats (const char* name) const
 {
-	if (kmers->size() < 1)
-	{
-		fprintf(stderr, "No elements in kmer hash in call to kmer::printStats\n");
-		fail = 1;
-		return;
-	}
-	if (stats->initial() == 0)
-	{
-		fprintf(stderr, "No statistics stored in memory pool in call to kmer::printStats\n");
-		fail = 1;
-		return;
-	}
-
-	std::stringstream seqstream;
-	node* curr_node = stats->headNode();
-	char* buf_loc = 0;
-	size_t i = 0;
-	size_t j = 0;
-	size_t block = 1;
-	T* val = 0;
+	KmerTable<H> table;
+	table.init(0, datamap.size());
+	bool added = false;
+	clock_t start = clock();
+	for (countmap::const_iterator it = datamap.begin(); it != datamap.end(); ++it)
+		table.insert(it.key(), added);
+	double inserttime = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	size_t found = 0;
+	for (countmap::const_iterator it = datamap.begin(); it != datamap.end(); ++it)
+		found += table.find(it.key()) != KmerTable<H>::npos;
+	double findtime = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
 
-	for (countmap::const_iterator kIter = kmers->begin(); kIter != kmers->end(); ++kIter)
+	const int nbins = 7;
+	const char* binlabel [nbins] = {"0", "1", "2", "3-4", "5-8", "9-16", ">16"};
+	size_t hist [nbins] = {0};
+	size_t maxprobe = 0;
+	size_t sumprobe = 0;
+	size_t homes = 0;
+	size_t d = 0;
+	int bin = 0;
+	std::vector<bool> usedhome(table.capacity(), false);
+	for (size_t slot = 0; slot < table.capacity(); ++slot)
 	{
-		os << numtoseq(kIter->first.id, seqstream);
-		for (unsigned int k = 0; k < kIter->second.count.size(); ++k)
+		if (!table.full(slot))
+			continue;
+		d = table.displacement(slot);
+		sumprobe += d;
+		if (d > maxprobe)
+			maxprobe = d;
+		bin = d <= 2 ? d : d <= 4 ? 3 : d <= 8 ? 4 : d <= 16 ? 5 : 6;
+		++hist[bin];
+		size_t h = table.home(table.key(slot));
+		if (!usedhome[h])
 		{
-			os << "\t" << std::setw(12) << std::right << kIter->second.count[k];
+			usedhome[h] = true;
+			++homes;
 		}
-		for (j = 0; j < nstats; ++j)
-		{
-			buf_loc = curr_node->buf + sizeof(T) * i;
-			val = reinterpret_cast<T*> (buf_loc);
-			os << "\t" << std::setw(12) << std::setprecision(5) << std::scientific << std::right << *val;
-			++i;
-			if (i >= stats->blockSize())
-			{
-				++block;
-				if (block <= stats->nBlocks())
-				{
-					curr_node = curr_node->next;
-					buf_loc = curr_node->buf;
-					i = 0;
-				}
-			}
-		}
-		os << "\n";
 	}
+
+	size_t n = table.size() ? table.size() : 1;
+	fprintf(stderr, "%s: %lu kmers in %lu slots, %lu share a home slot, mean probe %.3f, max probe %lu, insert %.1f ns/kmer, find %.1f ns/kmer (%lu found)\n",
+		name, table.size(), table.capacity(), table.size() - homes, static_cast<double>(sumprobe) / n, maxprobe,
+		inserttime * 1e9 / n, findtime * 1e9 / n, found);
+	fprintf(stderr, "%s probe length histogram:", name);
+	for (bin = 0; bin < nbins; ++bin)
+		fprintf(stderr, " %s:%.4f", binlabel[bin], static_cast<double>(hist[bin]) / n);
+	fprintf(stderr, "\n");
 }
 
 #endif /* KMER_H_ */
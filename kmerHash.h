@@ -0,0 +1,73 @@
+/*
+ * kmerHash.h
+ *
+ * hash functions over packed kmers; any of these can be plugged into KmerTable
+ * none depend on the size of the table, which takes the bits it needs from the result
+ */
+
+#ifndef KMERHASH_H_
+#define KMERHASH_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include "packedKey.h"
+
+// mum multiplies two words and folds the 128-bit product, as in wyhash
+inline uint64_t mum (uint64_t a, uint64_t b)
+{
+	__uint128_t r = static_cast<__uint128_t>(a) * b;
+	return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+// fmix64 is the MurmurHash3 finalizer, a bijection on 64-bit words
+inline uint64_t fmix64 (uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// MixHasher is a wyhash-style multiply-fold over the key words (default)
+struct MixHasher
+{
+	size_t operator() (const Key& key) const
+	{
+		uint64_t h = 0x2d358dccaa6c78a5ULL;
+		for (int i = 0; i < KMER_WORDS; ++i)
+			h = mum(h ^ key.id[i] ^ 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL);
+		return mum(h ^ 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL);
+	}
+};
+
+// InvertibleHasher chains the MurmurHash3 finalizer over the key words, so for single-word
+// keys distinct kmers never share a full hash value
+struct InvertibleHasher
+{
+	size_t operator() (const Key& key) const
+	{
+		uint64_t h = 0;
+		for (int i = 0; i < KMER_WORDS; ++i)
+			h = fmix64(h ^ key.id[i]);
+		return h;
+	}
+};
+
+// PolyHasher is the original multiply-by-31 polynomial, kept for comparison
+struct PolyHasher
+{
+	size_t operator() (const Key& key) const
+	{
+		const int r = 31;
+		unsigned long int h = 0;
+		for(int i = 0; i < KMER_WORDS; ++i)
+			h = r * h + key.id[i];
+		return h;
+	}
+};
+
+typedef MixHasher KeyHasher;
+
+#endif /* KMERHASH_H_ */
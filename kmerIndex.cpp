@@ -0,0 +1,67 @@
+/*
+ * kmerIndex.cpp
+ */
+
+#include "kmerIndex.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+IndexMap::IndexMap ()
+	: _data(0),
+	  _len(0)
+{ }
+
+IndexMap::~IndexMap ()
+{
+	close();
+}
+
+// open maps all of fname, readable and privately writable
+bool IndexMap::open (const char* fname)
+{
+	close();
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not open file: %s\n", fname);
+		return false;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == 0 && static_cast<size_t>(sb.st_size) >= sizeof(IndexHeader))
+	{
+		void* addr = mmap(0, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED)
+		{
+			_data = static_cast<char*>(addr);
+			_len = sb.st_size;
+		}
+	}
+	::close(fd);
+	if (_data == 0)
+	{
+		fprintf(stderr, "%s is not a kmpare index file\n", fname);
+		return false;
+	}
+	return true;
+}
+
+void IndexMap::close ()
+{
+	if (_data)
+		munmap(_data, _len);
+	_data = 0;
+	_len = 0;
+}
+
+char* IndexMap::data () const
+{
+	return _data;
+}
+
+size_t IndexMap::size () const
+{
+	return _len;
+}
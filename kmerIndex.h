@@ -0,0 +1,83 @@
+/*
+ * kmerIndex.h
+ *
+ * kmer count index: the merged kmer table saved as it sits in memory, so that a later
+ * run maps the file and uses its slots in place instead of parsing the input again
+ *
+ * layout (native byte order, every section starting on a 64-byte boundary):
+ *   IndexHeader
+ *   nlibs uint64 library totals
+ *   nshards IndexShard descriptors (nshards = 2^shardbits)
+ *   for each shard, at the offsets of its descriptor: capacity control bytes, capacity * stride
+ *     uint64 slot words as laid out by KmerTable, npairs uint64 sparse pairs, and nwide records
+ *     of uint64 cell (slot * nlibs + library) and uint64 count for counts too large for countbytes
+ *   at ambigoffset, nambig kmers with ambiguous bases of merlen bytes each, by ordinal
+ * slots are placed by KeyHasher over KMER_WORDS-word keys, so the header records both and an
+ * index is only loaded by a build that agrees with them
+ */
+
+#ifndef KMERINDEX_H_
+#define KMERINDEX_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+const char indexMagic [8] = {'K', 'M', 'P', 'I', 'D', 'X', '2', '\0'};
+const size_t indexAlign = 64; // sections start at multiples of this
+
+struct IndexHeader
+{
+	char magic [8];
+	uint32_t keywords; // KMER_WORDS of the build that wrote the index
+	uint32_t merlen;
+	uint32_t nlibs;
+	uint32_t countbytes; // 1, 2, or 4
+	uint32_t sparse; // 1 if rows are sparse pairs
+	uint32_t shardbits;
+	uint32_t skipbits;
+	uint32_t canonical; // 1 if kmers were folded with their reverse complement
+	uint32_t mincount; // -min-count and -min-libs the table was filtered with
+	uint32_t minlibs;
+	uint64_t ntargets; // kmers on the -targets panel the table was loaded with, 0 if it holds every kmer
+	uint64_t hashcheck; // KeyHasher of a fixed key, to tell a change of hash function
+	uint64_t nkmers;
+	uint64_t nambig;
+	uint64_t ambigoffset;
+};
+
+struct IndexShard
+{
+	uint64_t capacity;
+	uint64_t size;
+	uint64_t npairs;
+	uint64_t nwide;
+	uint64_t ctrloffset;
+	uint64_t slaboffset;
+	uint64_t pairoffset;
+	uint64_t wideoffset;
+};
+
+// indexPadded returns n rounded up to a multiple of indexAlign
+inline uint64_t indexPadded (uint64_t n)
+{
+	return (n + indexAlign - 1) & ~static_cast<uint64_t>(indexAlign - 1);
+}
+
+// IndexMap maps an index file copy-on-write: tables attached to it can be changed without touching the file
+class IndexMap
+{
+public:
+	IndexMap ();
+	~IndexMap ();
+	bool open (const char* fname);
+	void close ();
+	char* data () const;
+	size_t size () const;
+private:
+	IndexMap (const IndexMap&);
+	IndexMap& operator= (const IndexMap&);
+	char* _data;
+	size_t _len;
+};
+
+#endif /* KMERINDEX_H_ */
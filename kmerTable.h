@@ -0,0 +1,699 @@
+/*
+ * kmerTable.h
+ *
+ * open-addressing hash table of packed kmers; each slot holds the Key followed by
+ * a fixed-stride row of per-library counts in a single contiguous slab
+ * counts are stored in 1, 2, or 4 bytes; a narrow count that does not fit is stored
+ * as the largest value of its width and its exact value is kept in a side table
+ * a sparse table instead keeps one word per slot pointing at a run of (library, count)
+ * pairs for the libraries where the kmer was seen, for inputs with many libraries
+ * a table can also be attached to control bytes, slots, and pairs held elsewhere (a mapped
+ * index file), which it reads and writes in place but never frees
+ */
+
+#ifndef KMERTABLE_H_
+#define KMERTABLE_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "packedKey.h"
+#include "kmerHash.h"
+
+template <class H>
+class KmerTable
+{
+public:
+	class const_iterator
+	{
+	public:
+		const_iterator (const KmerTable* table, size_t slot)
+			: _table(table),
+			  _slot(slot)
+		{
+			skip();
+		}
+		const_iterator& operator++ ()
+		{
+			++_slot;
+			skip();
+			return *this;
+		}
+		bool operator!= (const const_iterator& a) const
+		{
+			return _slot != a._slot;
+		}
+		bool operator== (const const_iterator& a) const
+		{
+			return _slot == a._slot;
+		}
+		const Key& key () const
+		{
+			return _table->key(_slot);
+		}
+		unsigned int count (unsigned int lib) const
+		{
+			return _table->count(_slot, lib);
+		}
+		void row (unsigned int counts []) const
+		{
+			_table->row(_slot, counts);
+		}
+		size_t slot () const
+		{
+			return _slot;
+		}
+	private:
+		void skip ()
+		{
+			while (_slot < _table->_cap && !_table->_ctrl[_slot])
+				++_slot;
+		}
+		const KmerTable* _table;
+		size_t _slot;
+	};
+
+	KmerTable ();
+	~KmerTable ();
+	void init (unsigned int nlibs, size_t nkeys, int skipbits = 0, unsigned int countbytes = sizeof(unsigned int), bool sparse = false);
+	void attach (unsigned int nlibs, int skipbits, unsigned int countbytes, bool sparse, size_t cap, size_t size,
+		unsigned char* ctrl, uint64_t* slab, const uint64_t* pairs, size_t npairs);
+	void reserve (size_t nkeys);
+	void widen (const KmerTable& from, unsigned int nlibs, size_t nkeys);
+	void clear ();
+	size_t insert (const Key& key, bool& added);
+	size_t insertConcurrent (const Key& key, uint64_t h, bool& added);
+	size_t find (const Key& key) const;
+	size_t displacement (size_t slot) const;
+	size_t home (const Key& key) const;
+	size_t home (uint64_t h) const;
+	uint64_t hash (const Key& key) const;
+	void placeAt (size_t slot, const Key& key, uint64_t h);
+	void countPlaced (size_t n);
+	bool full (size_t slot) const;
+	const Key& key (size_t slot) const;
+	unsigned int count (size_t slot, unsigned int lib) const;
+	void row (size_t slot, unsigned int counts []) const;
+	void setCount (size_t slot, unsigned int lib, unsigned int count);
+	void addCount (size_t slot, unsigned int lib, unsigned int count);
+	void setRow (size_t slot, const unsigned int counts []);
+	size_t allotPairs (size_t n);
+	size_t setPairs (size_t slot, const unsigned int counts [], size_t at);
+	void compactPairs ();
+	unsigned int countBytes () const;
+	size_t saturated () const;
+	bool sparse () const;
+	size_t npairs () const;
+	size_t stride () const;
+	const unsigned char* ctrlData () const;
+	const uint64_t* slabData () const;
+	const uint64_t* pairData () const;
+	const std::unordered_map<uint64_t, unsigned int>& wideCounts () const;
+	size_t size () const;
+	size_t capacity () const;
+	unsigned int nlibs () const;
+	const_iterator begin () const;
+	const_iterator end () const;
+	static const size_t npos = static_cast<size_t>(-1);
+private:
+	// private variables
+	unsigned char* _ctrl; // per-slot control byte: 0 if empty, otherwise 0x80 | 7 bits of the hash
+	uint64_t* _slab; // slot storage, _stride words per slot
+	size_t _cap; // number of slots, always a power of 2
+	size_t _size; // number of occupied slots
+	size_t _stride; // words per slot
+	int _shift; // 64 - log2(_cap)
+	int _skip; // high hash bits ignored when picking a home slot (already used to pick a shard)
+	unsigned int _nlibs; // counts per slot
+	unsigned int _width; // bytes per count
+	std::unordered_map<uint64_t, unsigned int> _wide; // exact values of saturated counts, keyed by slot * _nlibs + lib
+	std::mutex _widelock; // guards _wide while several threads set counts
+	bool _sparse; // rows are runs of _pairs rather than stored in the slab
+	std::vector<uint64_t> _pairs; // sparse rows: library << 32 | count, in library order within a run
+	bool _attached; // _ctrl and _slab belong to the caller of attach
+	const uint64_t* _attachedpairs; // sparse pairs given to attach, until more are allotted
+	size_t _nattachedpairs;
+	H _hasher;
+	//private functions
+	template <class C> unsigned int load (size_t slot, unsigned int lib) const;
+	template <class C> void store (size_t slot, unsigned int lib, unsigned int count);
+	void allocate (size_t cap);
+	void rehash (size_t cap);
+	static unsigned char tag (uint64_t h);
+	static size_t slotsFor (size_t nkeys);
+};
+
+const float maxLoad = 0.75; // table grows when this fraction of slots is occupied
+const unsigned char busySlot = 0x01; // control byte of a slot claimed by a thread that is still writing its key
+const size_t maxConcurrentProbe = 4096; // insertConcurrent gives up after this many slots
+const int sparseRunShift = 40; // a sparse slot's word holds its run's start in the low bits and its length above these
+
+template <class H> KmerTable<H>::KmerTable ()
+	: _ctrl(0),
+	  _slab(0),
+	  _cap(0),
+	  _size(0),
+	  _stride(0),
+	  _shift(64),
+	  _skip(0),
+	  _nlibs(0),
+	  _width(sizeof(unsigned int)),
+	  _sparse(false),
+	  _attached(false),
+	  _attachedpairs(0),
+	  _nattachedpairs(0)
+{ }
+
+template <class H> KmerTable<H>::~KmerTable ()
+{
+	clear();
+}
+
+// init sets the number of libraries per row and the bytes per count (1, 2, or 4) or sparse rows, and reserves space for nkeys kmers
+template <class H> void KmerTable<H>::init (unsigned int nlibs, size_t nkeys, int skipbits, unsigned int countbytes, bool sparse)
+{
+	clear();
+	_nlibs = nlibs;
+	_skip = skipbits;
+	_width = countbytes;
+	_sparse = sparse;
+	_stride = KMER_WORDS + (_sparse ? 1 : (nlibs * _width + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	allocate(slotsFor(nkeys));
+}
+
+// attach makes the table use cap slots (a power of 2) of control bytes and slot words already laid out by a table of
+// the same shape and hash, holding size kmers, and npairs sparse pairs; the memory must outlive the table or its next
+// clear, init, or growth
+template <class H> void KmerTable<H>::attach (unsigned int nlibs, int skipbits, unsigned int countbytes, bool sparse, size_t cap, size_t size,
+	unsigned char* ctrl, uint64_t* slab, const uint64_t* pairs, size_t npairs)
+{
+	clear();
+	_nlibs = nlibs;
+	_skip = skipbits;
+	_width = countbytes;
+	_sparse = sparse;
+	_stride = KMER_WORDS + (_sparse ? 1 : (nlibs * _width + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	_cap = cap;
+	for (_shift = 64; cap > 1; cap >>= 1)
+		--_shift;
+	_size = size;
+	_ctrl = ctrl;
+	_slab = slab;
+	_attached = true;
+	_attachedpairs = pairs;
+	_nattachedpairs = npairs;
+}
+
+// widen makes this table a copy of from with nlibs libraries, those from lacks counting zero, and room for nkeys kmers;
+// while that fits in the capacity of from every kmer keeps its slot and no key is hashed
+template <class H> void KmerTable<H>::widen (const KmerTable& from, unsigned int nlibs, size_t nkeys)
+{
+	init(nlibs, 0, from._skip, from._width, from._sparse);
+	rehash(std::max(slotsFor(nkeys), from._cap));
+	std::vector<unsigned int> counts(nlibs, 0);
+	bool added = false;
+	size_t to = 0;
+	for (size_t slot = 0; slot < from._cap; ++slot)
+	{
+		if (!from._ctrl[slot])
+			continue;
+		from.row(slot, &counts[0]);
+		if (_cap == from._cap)
+		{
+			to = slot;
+			_ctrl[to] = from._ctrl[slot];
+			uint64_t* s = _slab + to * _stride;
+			*reinterpret_cast<Key*>(s) = from.key(slot);
+			memset(s + KMER_WORDS, 0, (_stride - KMER_WORDS) * sizeof(uint64_t));
+			++_size;
+		}
+		else
+			to = insert(from.key(slot), added);
+		setRow(to, &counts[0]);
+	}
+}
+
+// reserve grows the table so that nkeys kmers fit without exceeding the load limit
+template <class H> void KmerTable<H>::reserve (size_t nkeys)
+{
+	size_t cap = slotsFor(nkeys);
+	if (cap > _cap)
+		rehash(cap);
+}
+
+template <class H> void KmerTable<H>::clear ()
+{
+	if (!_attached)
+	{
+		delete [] _ctrl;
+		delete [] _slab;
+	}
+	_attached = false;
+	_attachedpairs = 0;
+	_nattachedpairs = 0;
+	_ctrl = 0;
+	_slab = 0;
+	_cap = 0;
+	_size = 0;
+	_shift = 64;
+	_wide.clear();
+	std::vector<uint64_t>().swap(_pairs);
+}
+
+// insert returns the slot holding key, adding it with a zeroed count row if it is not already present
+template <class H> size_t KmerTable<H>::insert (const Key& key, bool& added)
+{
+	if (_size + 1 > _cap * maxLoad)
+	{
+		std::cerr << "Increasing reserve to accommodate additional kmers...\n";
+		rehash(_cap * 2);
+	}
+	uint64_t h = _hasher(key);
+	unsigned char t = tag(h);
+	size_t slot = home(h);
+	uint64_t* s = 0;
+	while (_ctrl[slot])
+	{
+		s = _slab + slot * _stride;
+		if (_ctrl[slot] == t && *reinterpret_cast<const Key*>(s) == key)
+		{
+			added = false;
+			return slot;
+		}
+		slot = (slot + 1) & (_cap - 1);
+	}
+	_ctrl[slot] = t;
+	s = _slab + slot * _stride;
+	*reinterpret_cast<Key*>(s) = key;
+	memset(s + KMER_WORDS, 0, (_stride - KMER_WORDS) * sizeof(uint64_t));
+	++_size;
+	added = true;
+	return slot;
+}
+
+// insertConcurrent is insert for a table shared by several writer threads; it never grows the table, so it
+// returns npos if no free slot turns up within maxConcurrentProbe slots of the home position
+// an empty slot is claimed by swapping its control byte to busySlot, and the tag is published once the key is written
+template <class H> size_t KmerTable<H>::insertConcurrent (const Key& key, uint64_t h, bool& added)
+{
+	unsigned char t = tag(h);
+	size_t slot = home(h);
+	unsigned char c = 0;
+	uint64_t* s = 0;
+	added = false;
+	for (size_t probe = 0; probe < maxConcurrentProbe && probe < _cap; ++probe)
+	{
+		c = __atomic_load_n(&_ctrl[slot], __ATOMIC_ACQUIRE);
+		if (c == 0)
+		{
+			if (__atomic_compare_exchange_n(&_ctrl[slot], &c, busySlot, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				s = _slab + slot * _stride;
+				*reinterpret_cast<Key*>(s) = key;
+				memset(s + KMER_WORDS, 0, (_stride - KMER_WORDS) * sizeof(uint64_t));
+				__atomic_store_n(&_ctrl[slot], t, __ATOMIC_RELEASE);
+				added = true;
+				return slot;
+			}
+		}
+		while (c == busySlot)
+			c = __atomic_load_n(&_ctrl[slot], __ATOMIC_ACQUIRE);
+		if (c == t && *reinterpret_cast<const Key*>(_slab + slot * _stride) == key)
+			return slot;
+		slot = (slot + 1) & (_cap - 1);
+	}
+	return npos;
+}
+
+// find returns the slot holding key or npos if key is not in the table
+template <class H> size_t KmerTable<H>::find (const Key& key) const
+{
+	if (_cap == 0)
+		return npos;
+	uint64_t h = _hasher(key);
+	unsigned char t = tag(h);
+	size_t slot = home(h);
+	while (_ctrl[slot])
+	{
+		if (_ctrl[slot] == t && *reinterpret_cast<const Key*>(_slab + slot * _stride) == key)
+			return slot;
+		slot = (slot + 1) & (_cap - 1);
+	}
+	return npos;
+}
+
+// displacement returns how many slots past its home position the kmer in slot is stored
+template <class H> size_t KmerTable<H>::displacement (size_t slot) const
+{
+	return (slot - home(_hasher(key(slot)))) & (_cap - 1);
+}
+
+// home returns the first slot probed for key
+template <class H> size_t KmerTable<H>::home (const Key& key) const
+{
+	return home(_hasher(key));
+}
+
+template <class H> uint64_t KmerTable<H>::hash (const Key& key) const
+{
+	return _hasher(key);
+}
+
+// placeAt stores key with hash h and a zeroed count row in the empty slot given by the caller
+// used for bulk loads where the caller already knows where linear probing would put the key;
+// the table size is updated afterwards with countPlaced
+template <class H> void KmerTable<H>::placeAt (size_t slot, const Key& key, uint64_t h)
+{
+	_ctrl[slot] = tag(h);
+	uint64_t* s = _slab + slot * _stride;
+	*reinterpret_cast<Key*>(s) = key;
+	memset(s + KMER_WORDS, 0, (_stride - KMER_WORDS) * sizeof(uint64_t));
+}
+
+template <class H> void KmerTable<H>::countPlaced (size_t n)
+{
+	_size += n;
+}
+
+template <class H> bool KmerTable<H>::full (size_t slot) const
+{
+	return _ctrl[slot] != 0;
+}
+
+template <class H> const Key& KmerTable<H>::key (size_t slot) const
+{
+	return *reinterpret_cast<const Key*>(_slab + slot * _stride);
+}
+
+template <class H> unsigned int KmerTable<H>::count (size_t slot, unsigned int lib) const
+{
+	if (_sparse)
+	{
+		uint64_t run = _slab[slot * _stride + KMER_WORDS];
+		const uint64_t* p = pairData() + (run & ((static_cast<uint64_t>(1) << sparseRunShift) - 1));
+		for (const uint64_t* end = p + (run >> sparseRunShift); p < end; ++p)
+			if ((*p >> 32) == lib)
+				return static_cast<unsigned int>(*p);
+		return 0;
+	}
+	if (_width == 1)
+		return load<uint8_t>(slot, lib);
+	if (_width == 2)
+		return load<uint16_t>(slot, lib);
+	return load<uint32_t>(slot, lib);
+}
+
+// row copies the counts of the kmer in slot to counts
+template <class H> void KmerTable<H>::row (size_t slot, unsigned int counts []) const
+{
+	unsigned int lib = 0;
+	if (_sparse)
+	{
+		memset(counts, 0, _nlibs * sizeof(unsigned int));
+		uint64_t run = _slab[slot * _stride + KMER_WORDS];
+		const uint64_t* p = pairData() + (run & ((static_cast<uint64_t>(1) << sparseRunShift) - 1));
+		for (const uint64_t* end = p + (run >> sparseRunShift); p < end; ++p)
+			counts[*p >> 32] = static_cast<unsigned int>(*p);
+	}
+	else if (_width == 1)
+		for (lib = 0; lib < _nlibs; ++lib)
+			counts[lib] = load<uint8_t>(slot, lib);
+	else if (_width == 2)
+		for (lib = 0; lib < _nlibs; ++lib)
+			counts[lib] = load<uint16_t>(slot, lib);
+	else
+		for (lib = 0; lib < _nlibs; ++lib)
+			counts[lib] = load<uint32_t>(slot, lib);
+}
+
+// setCount sets one library's count for the kmer in slot; safe while other threads set other counts, except in
+// a sparse table, where the row is rewritten at the end of the pairs
+template <class H> void KmerTable<H>::setCount (size_t slot, unsigned int lib, unsigned int count)
+{
+	if (_sparse)
+	{
+		std::vector<unsigned int> counts(_nlibs);
+		row(slot, &counts[0]);
+		counts[lib] = count;
+		setRow(slot, &counts[0]);
+	}
+	else if (_width == 1)
+		store<uint8_t>(slot, lib, count);
+	else if (_width == 2)
+		store<uint16_t>(slot, lib, count);
+	else
+		store<uint32_t>(slot, lib, count);
+}
+
+// addCount adds to one library's count for the kmer in slot, stopping at the largest count; unlike setCount it
+// needs a single writer per count
+template <class H> void KmerTable<H>::addCount (size_t slot, unsigned int lib, unsigned int count)
+{
+	unsigned int old = this->count(slot, lib);
+	setCount(slot, lib, count < ~old ? old + count : ~0U);
+}
+
+template <class H> void KmerTable<H>::setRow (size_t slot, const unsigned int counts [])
+{
+	unsigned int lib = 0;
+	if (_sparse)
+	{
+		size_t n = 0;
+		for (lib = 0; lib < _nlibs; ++lib)
+			n += counts[lib] != 0;
+		setPairs(slot, counts, allotPairs(n));
+		return;
+	}
+	for (lib = 0; lib < _nlibs; ++lib)
+		setCount(slot, lib, counts[lib]);
+}
+
+// allotPairs appends room for n sparse pairs and returns where it starts; threads can then fill disjoint parts with setPairs
+template <class H> size_t KmerTable<H>::allotPairs (size_t n)
+{
+	if (_attachedpairs)
+	{
+		_pairs.assign(_attachedpairs, _attachedpairs + _nattachedpairs);
+		_attachedpairs = 0;
+		_nattachedpairs = 0;
+	}
+	size_t at = _pairs.size();
+	_pairs.resize(at + n);
+	return at;
+}
+
+// setPairs writes the nonzero counts of a sparse row starting at pair at, which was allotted beforehand, and returns the next free pair
+template <class H> size_t KmerTable<H>::setPairs (size_t slot, const unsigned int counts [], size_t at)
+{
+	size_t start = at;
+	for (unsigned int lib = 0; lib < _nlibs; ++lib)
+		if (counts[lib])
+			_pairs[at++] = static_cast<uint64_t>(lib) << 32 | counts[lib];
+	_slab[slot * _stride + KMER_WORDS] = start | static_cast<uint64_t>(at - start) << sparseRunShift;
+	return at;
+}
+
+// compactPairs copies the runs of a sparse table into new pairs in slot order, dropping the runs that setCount
+// left behind when it rewrote a row
+template <class H> void KmerTable<H>::compactPairs ()
+{
+	if (!_sparse)
+		return;
+	const uint64_t mask = (static_cast<uint64_t>(1) << sparseRunShift) - 1;
+	size_t slot = 0;
+	size_t n = 0;
+	for (slot = 0; slot < _cap; ++slot)
+		if (_ctrl[slot])
+			n += _slab[slot * _stride + KMER_WORDS] >> sparseRunShift;
+	std::vector<uint64_t> pairs;
+	pairs.reserve(n);
+	const uint64_t* from = pairData();
+	for (slot = 0; slot < _cap; ++slot)
+	{
+		if (!_ctrl[slot])
+			continue;
+		uint64_t& run = _slab[slot * _stride + KMER_WORDS];
+		uint64_t start = pairs.size();
+		pairs.insert(pairs.end(), from + (run & mask), from + (run & mask) + (run >> sparseRunShift));
+		run = start | (run & ~mask);
+	}
+	_pairs.swap(pairs);
+	_attachedpairs = 0;
+	_nattachedpairs = 0;
+}
+
+template <class H> unsigned int KmerTable<H>::countBytes () const
+{
+	return _width;
+}
+
+template <class H> bool KmerTable<H>::sparse () const
+{
+	return _sparse;
+}
+
+template <class H> size_t KmerTable<H>::npairs () const
+{
+	return _attachedpairs ? _nattachedpairs : _pairs.size();
+}
+
+template <class H> size_t KmerTable<H>::stride () const
+{
+	return _stride;
+}
+
+// ctrlData, slabData, and pairData expose the table's storage for writing it out whole; wideCounts holds the exact
+// values of saturated counts keyed by slot * nlibs + library
+template <class H> const unsigned char* KmerTable<H>::ctrlData () const
+{
+	return _ctrl;
+}
+
+template <class H> const uint64_t* KmerTable<H>::slabData () const
+{
+	return _slab;
+}
+
+template <class H> const uint64_t* KmerTable<H>::pairData () const
+{
+	return _attachedpairs ? _attachedpairs : _pairs.data();
+}
+
+template <class H> const std::unordered_map<uint64_t, unsigned int>& KmerTable<H>::wideCounts () const
+{
+	return _wide;
+}
+
+// saturated returns how many counts did not fit their width and live in the side table
+template <class H> size_t KmerTable<H>::saturated () const
+{
+	return _wide.size();
+}
+
+template <class H> template <class C> unsigned int KmerTable<H>::load (size_t slot, unsigned int lib) const
+{
+	C c = reinterpret_cast<const C*>(_slab + slot * _stride + KMER_WORDS)[lib];
+	if (sizeof(C) < sizeof(unsigned int) && c == static_cast<C>(-1))
+		return _wide.find(slot * _nlibs + lib)->second;
+	return c;
+}
+
+template <class H> template <class C> void KmerTable<H>::store (size_t slot, unsigned int lib, unsigned int count)
+{
+	C* c = reinterpret_cast<C*>(_slab + slot * _stride + KMER_WORDS) + lib;
+	const C most = static_cast<C>(-1);
+	if (sizeof(C) < sizeof(unsigned int) && (count >= most || *c == most))
+	{
+		std::lock_guard<std::mutex> lock(_widelock);
+		if (count >= most)
+			_wide[slot * _nlibs + lib] = count;
+		else
+			_wide.erase(slot * _nlibs + lib);
+	}
+	__atomic_store_n(c, static_cast<C>(count < most ? count : most), __ATOMIC_RELAXED);
+}
+
+template <class H> size_t KmerTable<H>::size () const
+{
+	return _size;
+}
+
+template <class H> size_t KmerTable<H>::capacity () const
+{
+	return _cap;
+}
+
+template <class H> unsigned int KmerTable<H>::nlibs () const
+{
+	return _nlibs;
+}
+
+template <class H> typename KmerTable<H>::const_iterator KmerTable<H>::begin () const
+{
+	return const_iterator(this, 0);
+}
+
+template <class H> typename KmerTable<H>::const_iterator KmerTable<H>::end () const
+{
+	return const_iterator(this, _cap);
+}
+
+template <class H> void KmerTable<H>::allocate (size_t cap)
+{
+	_cap = cap;
+	_shift = 64;
+	while (cap > 1)
+	{
+		--_shift;
+		cap >>= 1;
+	}
+	_attached = false;
+	_ctrl = new unsigned char[_cap];
+	memset(_ctrl, 0, _cap);
+	_slab = new uint64_t[_cap * _stride];
+	_size = 0;
+}
+
+// rehash moves every kmer into a table of cap slots
+template <class H> void KmerTable<H>::rehash (size_t cap)
+{
+	unsigned char* oldctrl = _ctrl;
+	uint64_t* oldslab = _slab;
+	size_t oldcap = _cap;
+	bool attached = _attached;
+	std::unordered_map<uint64_t, unsigned int> wide; // side table entries at their new slots
+	allocate(cap);
+	uint64_t h = 0;
+	size_t slot = 0;
+	for (size_t i = 0; i < oldcap; ++i)
+	{
+		if (!oldctrl[i])
+			continue;
+		h = _hasher(*reinterpret_cast<const Key*>(oldslab + i * _stride));
+		slot = home(h);
+		while (_ctrl[slot])
+			slot = (slot + 1) & (_cap - 1);
+		_ctrl[slot] = oldctrl[i];
+		memcpy(_slab + slot * _stride, oldslab + i * _stride, _stride * sizeof(uint64_t));
+		++_size;
+		for (unsigned int lib = 0; !_wide.empty() && lib < _nlibs; ++lib)
+		{
+			std::unordered_map<uint64_t, unsigned int>::iterator w = _wide.find(i * _nlibs + lib);
+			if (w != _wide.end())
+				wide[slot * _nlibs + lib] = w->second;
+		}
+	}
+	_wide.swap(wide);
+	if (!attached)
+	{
+		delete [] oldctrl;
+		delete [] oldslab;
+	}
+}
+
+// home maps a hash to its first probe position using its high bits
+template <class H> size_t KmerTable<H>::home (uint64_t h) const
+{
+	return (h << _skip) >> _shift;
+}
+
+template <class H> unsigned char KmerTable<H>::tag (uint64_t h)
+{
+	return 0x80 | (h & 0x7F);
+}
+
+template <class H> size_t KmerTable<H>::slotsFor (size_t nkeys)
+{
+	size_t cap = 16;
+	while (cap * maxLoad < nkeys)
+		cap <<= 1;
+	return cap;
+}
+
+#endif /* KMERTABLE_H_ */
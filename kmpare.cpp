@@ -6,10 +6,16 @@
 #include <cstring>
 #include <cstdlib>
 #include <sstream>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "kmpare.h"
 #include "kmer.h"
 #include "parseData.h"
-#include "memPool.h"
 
 //int main (int argc, char** argv)
 int main (int argc, char** argv)
@@ -18,55 +24,216 @@ int main (int argc, char** argv)
 	std::vector<std::string> infiles;
 	std::vector< std::vector<unsigned int> > sets;
 	std::string fout;
+	runOptions opts;
 	if (argc == 1)
 	{
 		info(version);
 		return 0;
 	}
-	if ( !parseArgs(argc, argv, &infiles, &sets, fout) )
+	if ( !parseArgs(argc, argv, &infiles, &sets, fout, &opts) )
 		return 0;
 
+	if (opts.benchingest)
+		benchIngest(infiles, opts);
+
 	// initialize objects
 	kmer jellydata; // handles kmer data
+	jellydata.tablebytes = opts.tablebytes;
+	jellydata.sparse = opts.sparse;
+	jellydata.mincount = opts.mincount;
+	jellydata.minlibs = opts.minlibs;
+	jellydata.canonical = opts.canonical;
+	jellydata.pvalues = opts.pvalues;
+	jellydata.top = opts.top;
+	if (opts.useminstat)
+		jellydata.minstat = opts.minstat;
 
-	// open outfile stream
-	if ( fexists(fout.c_str()) )
+	// open outfile stream; a server answers on its own channel instead
+	std::ofstream os;
+	if (!opts.serve)
 	{
-		std::cerr << "File already exists: " << fout << "\n" << "-->exiting";
+		if ( fexists(fout.c_str()) )
+		{
+			std::cerr << "File already exists: " << fout << "\n" << "-->exiting";
+			return 0;
+		}
+		os.open(fout.c_str());
+		if (os.fail())
+		{
+			std::cerr << "Could not open file: " << fout << "\n" << "-->exiting\n";
+			return 1;
+		}
+	}
+
+	// convert binary results to text
+	if (!opts.totext.empty())
+	{
+		std::cerr << "Converting " << opts.totext << " to text in file: " << fout << "\n";
+		if (!binToText(opts.totext, os))
+		{
+			std::cerr << "--> exiting\n";
+			return 1;
+		}
+		std::cerr << "finished!\n";
 		return 0;
 	}
-	std::ofstream os(fout.c_str());
-	if (os.fail())
+
+	// binary output picks its count width from the whole table unless the table is seen in pieces
+	ResultWriter binout(os, opts.countbytes || !(opts.stream || opts.maxmemory) ? opts.countbytes : sizeof(unsigned int), opts.statbytes, opts.pvalues);
+	ResultWriter* bin = opts.binary ? &binout : 0;
+
+	// read the panel of the only kmers to load
+	if (!opts.targets.empty() && !jellydata.loadTargets(opts.targets, infiles))
 	{
-		std::cerr << "Could not open file: " << fout << "\n" << "-->exiting\n";
+		std::cerr << "--> exiting\n";
 		return 1;
 	}
 
-	// parse Jellyfish files
-	jellydata.parseJellyCounts(infiles);
-	if (jellydata.fail)
+	// merge sorted input without holding it in memory
+	if (opts.stream)
+	{
+		std::cerr << "Dumping results to file: " << fout << "\n";
+		if (!bin)
+			printHeader(os, infiles.size(), &sets, opts.pvalues);
+		jellydata.streamJellyCounts(infiles, &sets, os, opts.nthreads, bin);
+		if (jellydata.fail || (bin && !bin->close()))
+		{
+			std::cerr << "--> exiting\n";
+			return 1;
+		}
+		std::cerr << jellydata.nkmers() << " kmer sequences in the dataset\n" << "finished!\n";
+		return 0;
+	}
+
+	// find kmers that cannot reach -min-count or -min-libs so they never take up table space
+	if ((opts.mincount > 1 || opts.minlibs > 1) && opts.loadindex.empty())
+	{
+		if (opts.presize)
+			jellydata.sketchKmers(infiles, opts.nthreads);
+		jellydata.buildFilter(infiles, opts.nthreads);
+	}
+
+	// work through the input in partitions on disk if it would not fit in memory
+	int partbits = 0;
+	if (opts.maxmemory > 0)
+	{
+		jellydata.countBytes(infiles);
+		size_t need = jellydata.memoryEstimate(jellydata.estimateKmers(infiles), infiles.size());
+		while ((need >> partbits) > opts.maxmemory && partbits < maxPartBits)
+			++partbits;
+		if (partbits > 0)
+			fprintf(stderr, "Estimated %.1f MB needed exceeds -max-memory, processing %d partitions on disk\n", need / 1e6, 1 << partbits);
+	}
+	if (partbits > 0)
+	{
+		std::vector<std::string> parts;
+		if (!jellydata.spillPartitions(infiles, partbits, fout, &parts))
+		{
+			std::cerr << "--> exiting\n";
+			return 1;
+		}
+		jellydata.clearFilter();
+		for (size_t p = 0; jellydata.ranks() && p < parts.size() && !jellydata.fail; ++p)
+		{
+			std::cerr << "Scoring partition " << p + 1 << " of " << parts.size() << " for ranking\n";
+			if (jellydata.loadPartition(parts[p], partbits) && jellydata.nkmers() > 0)
+				jellydata.collectStats(&jellydata.datamap, &sets, opts.nthreads);
+		}
+		if (jellydata.ranks() && !jellydata.fail)
+			jellydata.finishStats(opts.nthreads);
+		std::cerr << "Dumping results to file: " << fout << "\n";
+		if (!bin)
+			printHeader(os, infiles.size(), &sets, opts.pvalues);
+		for (size_t p = 0; p < parts.size(); ++p)
+		{
+			std::cerr << "Processing partition " << p + 1 << " of " << parts.size() << "\n";
+			if (jellydata.loadPartition(parts[p], partbits) && jellydata.nkmers() > 0)
+				analyze(jellydata, &sets, os, bin, opts.nthreads);
+			remove(parts[p].c_str());
+			if (jellydata.fail)
+			{
+				for (++p; p < parts.size(); ++p)
+					remove(parts[p].c_str());
+				std::cerr << "--> exiting\n";
+				return 1;
+			}
+		}
+		if (bin && !bin->close())
+		{
+			std::cerr << "--> exiting\n";
+			return 1;
+		}
+		std::cerr << "finished!\n";
+		return 0;
+	}
+
+	// parse Jellyfish files, or map the table saved by an earlier run
+	if (!opts.loadindex.empty())
+	{
+		if (opts.presize && !infiles.empty())
+			jellydata.sketchKmers(infiles, opts.nthreads);
+		std::cerr << "Loading kmer index: " << opts.loadindex << "\n";
+		if (jellydata.loadIndex(opts.loadindex) && !infiles.empty())
+			jellydata.appendLibraries(infiles);
+	}
+	else
+	{
+		if (opts.presize && opts.ingest != "merge")
+			jellydata.sketchKmers(infiles, opts.nthreads);
+		if (opts.ingest == "merge")
+			jellydata.parseJellyParallel(infiles, opts.nthreads);
+		else if (opts.ingest == "shard")
+			jellydata.parseJellySharded(infiles, opts.nthreads, opts.shardbits);
+		else if (opts.ingest == "atomic")
+			jellydata.parseJellyAtomic(infiles, opts.nthreads);
+		else
+			jellydata.parseJellyCounts(infiles);
+		jellydata.clearFilter();
+	}
+	if (jellydata.fail || (!opts.saveindex.empty() && !jellydata.saveIndex(opts.saveindex)))
+	{
+		std::cerr << "--> exiting\n";
+		return 1;
+	}
+	if (!checkSets(&sets, jellydata.libtotal.size()))
 	{
 		std::cerr << "--> exiting\n";
 		return 1;
 	}
 	std::cerr << jellydata.nkmers() << " kmer sequences in the dataset\n";
+	if (jellydata.datamap.saturated() > 0)
+		std::cerr << jellydata.datamap.saturated() << " counts too large for " << jellydata.datamap.countBytes() << " byte(s) are kept in a side table\n";
+	if (opts.hashstats)
+	{
+		jellydata.probeStats<MixHasher>("mix");
+		jellydata.probeStats<InvertibleHasher>("invertible");
+		jellydata.probeStats<PolyHasher>("poly31");
+	}
 
-	// analyze kmer counts
-	MemPool<double> stats;
-	jellydata.fit(&jellydata.datamap, &stats, &sets);
-	if (jellydata.fail)
+	// answer queries against the table until told to stop
+	if (opts.serve)
 	{
-		std::cerr << "ERROR: Kmer count analysis failed\n" << "--> exiting\n";
-		return 1;
+		if (!serve(jellydata, &sets, opts.socket))
+		{
+			std::cerr << "--> exiting\n";
+			return 1;
+		}
+		std::cerr << "finished!\n";
+		return 0;
 	}
 
-	// print result
+	// analyze kmer counts and print result
+	if (jellydata.ranks())
+	{
+		jellydata.collectStats(&jellydata.datamap, &sets, opts.nthreads);
+		jellydata.finishStats(opts.nthreads);
+	}
 	std::cerr << "Dumping results to file: " << fout << "\n";
-	printHeader(os, infiles.size(), &sets);
-	jellydata.printStats(os, &jellydata.datamap, sets.size(), &stats);
-	if (jellydata.fail)
+	if (!bin)
+		printHeader(os, jellydata.libtotal.size(), &sets, opts.pvalues);
+	if (!analyze(jellydata, &sets, os, bin, opts.nthreads) || (bin && !bin->close()))
 	{
-		std::cerr << "ERROR: Printing results failed\n" << "--> exiting\n";
+		std::cerr << "--> exiting\n";
 		return 1;
 	}
 
@@ -74,7 +241,225 @@ int main (int argc, char** argv)
 	return 0;
 }
 
-bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::vector< std::vector<unsigned int> >* cmpindex, std::string& ofname)
+// analyze computes goodness-of-fit statistics for the kmers held in jellydata and prints them, as text or to bin if given
+bool analyze (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, std::ofstream& os, ResultWriter* bin, unsigned int nthreads)
+{
+	jellydata.fit(os, &jellydata.datamap, sets, bin, nthreads);
+	if (jellydata.fail)
+	{
+		std::cerr << "ERROR: Kmer count analysis failed\n";
+		return false;
+	}
+	return true;
+}
+
+// serve answers query sessions (see serveSession) on standard input and output, or one client at a time on a Unix
+// socket at path if it is given, until a session sends "shutdown" or, without a socket, until input ends
+bool serve (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, const std::string& path)
+{
+	signal(SIGPIPE, SIG_IGN);
+	if (path.empty())
+	{
+		std::cerr << "Serving queries on standard input\n";
+		serveSession(jellydata, sets, stdin, STDOUT_FILENO);
+		return true;
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		std::cerr << "Socket path is too long: " << path << "\n";
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	struct stat sb;
+	if (stat(path.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode))
+		unlink(path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0)
+	{
+		std::cerr << "Could not listen on socket: " << path << " (" << strerror(errno) << ")\n";
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	std::cerr << "Serving queries on socket: " << path << "\n";
+	bool more = true;
+	while (more)
+	{
+		int client = accept(fd, 0, 0);
+		if (client < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "Could not accept a connection (" << strerror(errno) << ")\n";
+			break;
+		}
+		FILE* in = fdopen(client, "r");
+		if (!in)
+		{
+			close(client);
+			continue;
+		}
+		more = serveSession(jellydata, sets, in, client);
+		fclose(in);
+	}
+	close(fd);
+	unlink(path.c_str());
+	return !more;
+}
+
+// serveSession reads requests from in, one per line, and writes the answers to out; a line is a kmer, whose row in the
+// text output format is answered; "sets { 1 2 } ..." replaces the -compset sets for the rest of the session and is
+// answered with the new header line; a blank line ends a batch and sends its answers followed by a blank line;
+// "quit" ends the session and "shutdown" also stops the server, which is what a false return means
+bool serveSession (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, FILE* in, int out)
+{
+	std::vector< std::vector<unsigned int> > cur(*sets);
+	std::vector<std::string> seqs;
+	RowWriter text;
+	char* line = 0;
+	size_t cap = 0;
+	ssize_t len = 0;
+	bool more = true;
+	bool done = false;
+	while (!done && (len = getline(&line, &cap, in)) >= 0)
+	{
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		bool setsline = strncmp(line, "sets", 4) == 0 && (line[4] == ' ' || line[4] == '\t');
+		bool stop = strcmp(line, "quit") == 0 || strcmp(line, "shutdown") == 0;
+		bool command = len == 0 || setsline || stop;
+		if (!command)
+		{
+			seqs.push_back(std::string(line, len));
+			if (seqs.size() < gofBatch)
+				continue;
+		}
+		jellydata.queryKmers(seqs, &cur, text);
+		seqs.clear();
+		if (len == 0)
+			text.put('\n');
+		else if (setsline)
+		{
+			std::vector< std::vector<unsigned int> > next;
+			if (parseSetLine(line + 4, &next) && checkSets(&next, jellydata.libtotal.size()))
+			{
+				cur.swap(next);
+				std::ostringstream head;
+				printHeader(head, jellydata.libtotal.size(), &cur, false);
+				text.put(head.str().data(), head.str().size());
+			}
+			else
+				text.put("error: bad library sets\n", 24);
+		}
+		else if (stop)
+		{
+			more = strcmp(line, "shutdown") != 0;
+			done = true;
+		}
+		if ((command || text.size() >= rowBufferSize) && !sendRows(out, text))
+			done = true;
+	}
+	jellydata.queryKmers(seqs, &cur, text);
+	sendRows(out, text);
+	free(line);
+	return more;
+}
+
+// parseSetLine reads library sets written as for -compset, e.g. "{ 1 2 } { 1 2 3 }", from s into sets
+bool parseSetLine (const char* s, std::vector< std::vector<unsigned int> >* sets)
+{
+	std::istringstream words(s);
+	std::vector<std::string> tokens;
+	std::string word;
+	while (words >> word)
+		tokens.push_back(word);
+	if (tokens.empty() || tokens.back()[tokens.back().size() - 1] != '}')
+		return false;
+	std::vector<char*> argv(tokens.size() + 1, 0);
+	for (size_t i = 0; i < tokens.size(); ++i)
+		argv[i] = &tokens[i][0];
+	int argc = tokens.size();
+	for (int pos = 0; pos < argc; ++pos)
+	{
+		if (argv[pos][0] != '{')
+			return false;
+		sets->push_back(parseSet(argc, &argv[0], pos));
+		if (sets->back().empty())
+			return false;
+	}
+	return true;
+}
+
+// sendRows writes the rows held by text to fd and empties text
+bool sendRows (int fd, RowWriter& text)
+{
+	const char* p = text.data();
+	size_t left = text.size();
+	while (left > 0)
+	{
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			text.clear();
+			return false;
+		}
+		p += n;
+		left -= n;
+	}
+	text.clear();
+	return true;
+}
+
+// binToText prints a binary result file in the text format
+bool binToText (const std::string& fname, std::ofstream& os)
+{
+	ResultReader in;
+	if (!in.open(fname.c_str()))
+		return false;
+	const ResultHeader& head = in.header();
+	printHeader(os, head.nlibs, &in.sets(), head.pvalues);
+	RowWriter out(os);
+	for (uint64_t row = 0; row < head.nrows; ++row)
+	{
+		in.kmer(row, out.room(head.merlen));
+		out.advance(head.merlen);
+		for (unsigned int i = 0; i < head.nlibs; ++i)
+		{
+			out.put('\t');
+			out.putCount(in.count(row, i), 12);
+		}
+		for (unsigned int j = 0; j < head.nsets; ++j)
+		{
+			out.put('\t');
+			out.putStat(in.stat(row, j), 12, 5);
+		}
+		for (unsigned int j = 0; head.pvalues && j < head.nsets; ++j)
+		{
+			out.put('\t');
+			out.putStat(in.pvalue(row, j), 12, 5);
+		}
+		for (unsigned int j = 0; head.pvalues && j < head.nsets; ++j)
+		{
+			out.put('\t');
+			out.putStat(in.qvalue(row, j), 12, 5);
+		}
+		out.put('\n');
+	}
+	out.flush();
+	if (out.fail())
+	{
+		std::cerr << "Could not write output\n";
+		return false;
+	}
+	return true;
+}
+
+bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::vector< std::vector<unsigned int> >* cmpindex, std::string& ofname, runOptions* opts)
 {
 	int argpos = 1;
 	int counter = 0;
@@ -91,7 +476,7 @@ bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::ve
 		{
 			++argpos;
 			ifname->reserve(2);
-			while ( strcmp(argv[argpos], "-compset") && strcmp(argv[argpos], "-outfile"))
+			while (argv[argpos][0] != '-')
 			{
 				ifname->push_back(argv[argpos]);
 				++counter;
@@ -106,7 +491,7 @@ bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::ve
 		{
 			++argpos;
 			cmpindex->reserve(1);
-			while ( strcmp(argv[argpos], "-infile") && strcmp(argv[argpos], "-outfile"))
+			while (argv[argpos][0] != '-')
 			{
 				if (argv[argpos][0] == '{')
 				{
@@ -125,6 +510,212 @@ bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::ve
 			ofname = argv[argpos + 1];
 			argpos += 2;
 		}
+		else if ( strcmp(argv[argpos], "-ingest") == 0)
+		{
+			opts->ingest = argv[argpos + 1];
+			if (opts->ingest != "hash" && opts->ingest != "merge" && opts->ingest != "shard" && opts->ingest != "atomic")
+			{
+				fprintf(stderr, "Unknown -ingest mode: %s\n", argv[argpos + 1]);
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-threads") == 0)
+		{
+			opts->nthreads = atoi(argv[argpos + 1]);
+			if (opts->nthreads < 1)
+			{
+				fprintf(stderr, "-threads must be at least 1\n");
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-shardbits") == 0)
+		{
+			opts->shardbits = atoi(argv[argpos + 1]);
+			if (opts->shardbits < 0 || opts->shardbits > 16)
+			{
+				fprintf(stderr, "-shardbits must be between 0 and 16\n");
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-max-memory") == 0)
+		{
+			char* unit = 0;
+			double mem = strtod(argv[argpos + 1], &unit);
+			if (*unit == 'k' || *unit == 'K')
+				mem *= 1e3;
+			else if (*unit == 'm' || *unit == 'M')
+				mem *= 1e6;
+			else if (*unit == 'g' || *unit == 'G')
+				mem *= 1e9;
+			else if (*unit == 't' || *unit == 'T')
+				mem *= 1e12;
+			if (mem <= 0)
+			{
+				fprintf(stderr, "Invalid -max-memory: %s\n", argv[argpos + 1]);
+				return false;
+			}
+			opts->maxmemory = mem;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-stream") == 0)
+		{
+			opts->stream = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-countbits") == 0)
+		{
+			int bits = atoi(argv[argpos + 1]);
+			if (bits != 8 && bits != 16 && bits != 32)
+			{
+				fprintf(stderr, "-countbits must be 8, 16, or 32\n");
+				return false;
+			}
+			opts->tablebytes = bits / 8;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-sparse") == 0)
+		{
+			std::string mode = argv[argpos + 1];
+			if (mode == "auto")
+				opts->sparse = -1;
+			else if (mode == "yes")
+				opts->sparse = 1;
+			else if (mode == "no")
+				opts->sparse = 0;
+			else
+			{
+				fprintf(stderr, "Unknown -sparse setting: %s\n", argv[argpos + 1]);
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-presize") == 0)
+		{
+			std::string mode = argv[argpos + 1];
+			if (mode == "yes")
+				opts->presize = true;
+			else if (mode == "no")
+				opts->presize = false;
+			else
+			{
+				fprintf(stderr, "Unknown -presize setting: %s\n", argv[argpos + 1]);
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-min-count") == 0)
+		{
+			int n = atoi(argv[argpos + 1]);
+			if (n < 0)
+			{
+				fprintf(stderr, "-min-count must not be negative\n");
+				return false;
+			}
+			opts->mincount = n;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-min-libs") == 0)
+		{
+			int n = atoi(argv[argpos + 1]);
+			if (n < 0)
+			{
+				fprintf(stderr, "-min-libs must not be negative\n");
+				return false;
+			}
+			opts->minlibs = n;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-canonical") == 0)
+		{
+			opts->canonical = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-pvalues") == 0)
+		{
+			opts->pvalues = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-top") == 0)
+		{
+			long n = atol(argv[argpos + 1]);
+			if (n <= 0)
+			{
+				fprintf(stderr, "-top must be positive\n");
+				return false;
+			}
+			opts->top = n;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-min-stat") == 0)
+		{
+			opts->minstat = atof(argv[argpos + 1]);
+			opts->useminstat = true;
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-save-index") == 0)
+		{
+			opts->saveindex = argv[argpos + 1];
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-load-index") == 0)
+		{
+			opts->loadindex = argv[argpos + 1];
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-serve") == 0)
+		{
+			opts->serve = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-socket") == 0)
+		{
+			opts->serve = true;
+			opts->socket = argv[argpos + 1];
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-targets") == 0)
+		{
+			opts->targets = argv[argpos + 1];
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-binary") == 0)
+		{
+			opts->binary = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-countbytes") == 0)
+		{
+			opts->countbytes = atoi(argv[argpos + 1]);
+			if (opts->countbytes != 1 && opts->countbytes != 2 && opts->countbytes != 4)
+			{
+				fprintf(stderr, "-countbytes must be 1, 2, or 4\n");
+				return false;
+			}
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-float") == 0)
+		{
+			opts->statbytes = sizeof(float);
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-totext") == 0)
+		{
+			opts->totext = argv[argpos + 1];
+			argpos += 2;
+		}
+		else if ( strcmp(argv[argpos], "-benchingest") == 0)
+		{
+			opts->benchingest = true;
+			++argpos;
+		}
+		else if ( strcmp(argv[argpos], "-hashstats") == 0)
+		{
+			opts->hashstats = true;
+			++argpos;
+		}
 		else
 		{
 			fprintf(stderr, "Unknown command: %s\n", argv[argpos]);
@@ -133,35 +724,71 @@ bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::ve
 	}
 
 	//check arguments
-	if (ofname.empty())
+	if (opts->sparse > 0 && opts->ingest != "merge")
+	{
+		fprintf(stderr, "-sparse yes needs -ingest merge\n");
+		return false;
+	}
+
+	if (opts->canonical && opts->stream)
+	{
+		fprintf(stderr, "-canonical cannot be used with -stream, whose input must stay in kmer order\n");
+		return false;
+	}
+
+	if ((!opts->saveindex.empty() || !opts->loadindex.empty()) && (opts->stream || opts->maxmemory))
+	{
+		fprintf(stderr, "-save-index and -load-index need the whole kmer table in memory, without -stream or -max-memory\n");
+		return false;
+	}
+
+	if (!opts->targets.empty() && !opts->loadindex.empty())
+	{
+		fprintf(stderr, "-targets cannot be used with -load-index, whose table was loaded without the panel\n");
+		return false;
+	}
+
+	if (opts->serve && (opts->stream || opts->maxmemory || opts->binary || opts->pvalues || opts->top || opts->useminstat))
+	{
+		fprintf(stderr, "-serve answers queries from the whole kmer table in memory, without -stream, -max-memory, -binary, -pvalues,\n"
+			"-top, or -min-stat\n");
+		return false;
+	}
+
+	if (ofname.empty() && !opts->serve)
 	{
 		fprintf(stderr, "Must supply -outfile\n");
 		return false;
 	}
 
-	if (ifname->empty())
+	if (ifname->empty() && opts->totext.empty() && opts->loadindex.empty())
 	{
 		fprintf(stderr, "Must supply -infile\n");
 		return false;
 	}
 
-	if (!cmpindex->empty())
+	// with -load-index the libraries are only known once the index is read
+	if (opts->loadindex.empty() && opts->totext.empty())
+		return checkSets(cmpindex, ifname->size());
+
+	return true;
+}
+
+// checkSets checks that every library of the -compset sets is one of the nlibs libraries
+bool checkSets (const std::vector< std::vector<unsigned int> >* cmpindex, size_t nlibs)
+{
+	std::vector<unsigned int>::const_iterator elemIter;
+	for(std::vector< std::vector<unsigned int> >::const_iterator setIter = cmpindex->begin(); setIter != cmpindex->end(); ++setIter)
 	{
-		unsigned int nfiles_index = ifname->size() - 1;
-		std::vector<unsigned int>::const_iterator elemIter;
-		for(std::vector< std::vector<unsigned int> >::const_iterator setIter = cmpindex->begin(); setIter != cmpindex->end(); ++setIter)
+		for(elemIter = (*setIter).begin(); elemIter != (*setIter).end(); ++elemIter)
 		{
-			for(elemIter = (*setIter).begin(); elemIter != (*setIter).end(); ++elemIter)
+			if ( *elemIter >= nlibs)
 			{
-				if ( *elemIter > nfiles_index)
-				{
-					fprintf(stderr, "One of the libraries supplied to -compset exceeds number of input files\n");
-					return false;
-				}
+				fprintf(stderr, "One of the libraries supplied to -compset exceeds number of input files\n");
+				return false;
 			}
 		}
 	}
-
 	return true;
 }
 
@@ -193,19 +820,22 @@ std::vector<unsigned int> parseSet (int argc, char** argv, int& pos)
 	return set;
 }
 
-void printHeader (std::ofstream& os, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets)
+// printHeader writes the column names: kmer, the libraries, and a statistic per library set, followed with p-values
+// by the p-value ("p{ 1 2 }") and then the q-value ("q{ 1 2 }") of each set
+void printHeader (std::ostream& os, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets, bool pvalues)
 {
+	const char* prefix [] = {"", "p", "q"};
 	os << "kmer";
 	for(unsigned int i = 1; i <= nlibs; ++i)
 	{
 		os << "\t" << "lib" << i;
 	}
-	if (!sets->empty())
+	for (int k = 0; k < (pvalues ? 3 : 1) && !sets->empty(); ++k)
 	{
 		std::vector<unsigned int>::const_iterator libIter;
 		for(std::vector< std::vector<unsigned int> >::const_iterator setIter = sets->begin(); setIter != sets->end(); ++setIter)
 		{
-			os << "\t" << "{ ";
+			os << "\t" << prefix[k] << "{ ";
 			for(libIter = (*setIter).begin(); libIter != (*setIter).end(); ++libIter)
 			{
 				os << *libIter + 1 << " ";
@@ -216,14 +846,98 @@ void printHeader (std::ofstream& os, unsigned int nlibs, const std::vector< std:
 	os << "\n";
 }
 
+// benchIngest loads the input with every ingest mode, reporting wall time and checking the result against the single-threaded hash mode
+void benchIngest (std::vector<std::string>& infiles, const runOptions& opts)
+{
+	const char* modes [] = {"hash", "merge", "shard", "atomic"};
+	kmer* base = 0;
+	for (unsigned int m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m)
+	{
+		kmer* data = new kmer;
+		data->tablebytes = opts.tablebytes;
+		data->sparse = opts.sparse;
+		data->mincount = opts.mincount;
+		data->minlibs = opts.minlibs;
+		data->canonical = opts.canonical;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		data->buildFilter(infiles, m ? opts.nthreads : 1);
+		if (opts.presize && m != 1)
+			data->sketchKmers(infiles, m ? opts.nthreads : 1);
+		if (m == 0)
+			data->parseJellyCounts(infiles);
+		else if (m == 1)
+			data->parseJellyParallel(infiles, opts.nthreads);
+		else if (m == 2)
+			data->parseJellySharded(infiles, opts.nthreads, opts.shardbits);
+		else
+			data->parseJellyAtomic(infiles, opts.nthreads);
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (data->fail)
+		{
+			fprintf(stderr, "benchmark: %s ingest failed\n", modes[m]);
+			delete data;
+			break;
+		}
+		fprintf(stderr, "benchmark: %s ingest with %u thread(s): %lu kmers in %.3f seconds%s\n", modes[m], m ? opts.nthreads : 1, data->nkmers(), secs,
+			base ? (base->sameCounts(*data) ? ", counts match hash" : ", COUNTS DIFFER FROM hash") : "");
+		if (m == 0)
+			base = data;
+		else
+			delete data;
+	}
+	delete base;
+}
+
 void info (const char* v)
 {
 	fprintf(stderr, "\nkmpare version %s\n", v);
 	std::cerr << "\nInput:\n"
-	<< "-infile FILE Jellyfish text files of kmer counts\n"
+	<< "-infile FILE Jellyfish text files of kmer counts; kmers with ambiguous bases (N) are kept up to " << maxMerLength - 1 << " bases\n"
+	<< "             and skipped at " << maxMerLength << " (rebuild with a larger KMER_WORDS to keep them)\n"
 	<< "-compset {INT} set(s) of libraries to compare\n"
 	<< "-outfile FILE output file name\n"
+	<< "-ingest STRING how to load the input: hash (one file at a time), merge (parse libraries in parallel and merge),\n"
+	<< "               shard (split files among parser threads feeding per-shard table owners),\n"
+	<< "               or atomic (split files among threads inserting into one lock-free table) [hash]\n"
+	<< "-threads INT number of worker threads for loading the input and computing statistics [1]\n"
+	<< "-shardbits INT split the kmer table into 2^INT shards for -ingest shard [about half of -threads]\n"
+	<< "-max-memory FLOAT[K|M|G|T] memory budget in bytes; larger inputs are split into hash partitions on disk\n"
+	<< "                          next to -outfile and analyzed one partition at a time [no limit]\n"
+	<< "-countbits INT bits per count in the kmer table: 8, 16, or 32; larger counts are kept exactly in a side table\n"
+	<< "                  [fewest that hold twice the largest count in a sample of the input]\n"
+	<< "-sparse STRING store count rows as (library, count) pairs with -ingest merge: yes, no, or auto (when that at least\n"
+	<< "               halves the table, as with many libraries that mostly do not share kmers) [auto]\n"
+	<< "-presize STRING yes or no: estimate the distinct kmers in all input files with a HyperLogLog pass and size the\n"
+	<< "                kmer table for them before -ingest hash, shard, or atomic, instead of from the first file [yes]\n"
+	<< "-min-count INT drop kmers whose counts over all libraries sum to less than INT; a counting Bloom filter built\n"
+	<< "               in a first pass over the input keeps most of them out of the kmer table [1]\n"
+	<< "-min-libs INT drop kmers found in fewer than INT libraries, filtered the same way [1]\n"
+	<< "-canonical count each kmer together with its reverse complement, reported as whichever of the two sorts first\n"
+	<< "-pvalues also write each statistic's chi-square p-value (df one less than the set size) and its Benjamini-Hochberg\n"
+	<< "         q-value among all kmers scored against the set; the input is scored twice to rank the p-values\n"
+	<< "-top INT write only kmers whose statistic for some library set is among the INT highest for that set (ties\n"
+	<< "         with the last one are all written); every kmer is scored once first to find them\n"
+	<< "-min-stat FLOAT write only kmers whose statistic for some library set is at least FLOAT; with -top, a set\n"
+	<< "         selects a kmer only if its statistic meets both\n"
+	<< "-targets FILE load only the kmers listed in FILE, the first word of each line, and drop all others as the input\n"
+	<< "         is read, so the kmer table holds only the panel\n"
+	<< "-save-index FILE after loading the input, save the kmer table to FILE for -load-index\n"
+	<< "-load-index FILE analyze the kmer table saved in FILE instead of parsing the input; the file is mapped into\n"
+	<< "         memory as is. Any -infile files are appended to it as further libraries, numbered after those of\n"
+	<< "         the index, and only they are parsed; add -save-index to keep the result\n"
+	<< "-serve after loading the input, answer queries on standard input and output instead of writing -outfile: each\n"
+	<< "         line is a kmer, answered with its output row (zero counts if it is not in the table); \"sets { 1 2 } ...\"\n"
+	<< "         replaces the -compset sets and is answered with the header; a blank line sends the answers so far and a\n"
+	<< "         blank line; \"quit\" ends the session and \"shutdown\" the server\n"
+	<< "-socket PATH serve queries on a Unix domain socket at PATH, one client at a time, until a client sends shutdown\n"
+	<< "-stream input files are sorted by kmer; merge them in one pass without a kmer table (no kmers with ambiguous bases)\n"
+	<< "-binary write results in binary column blocks (see resultFile.h) instead of text\n"
+	<< "-countbytes INT bytes per count in binary output: 1, 2, or 4 [fewest that fit; 4 with -stream or -max-memory]\n"
+	<< "-float store statistics in binary output as float instead of double\n"
+	<< "-totext FILE convert a binary result file to text in -outfile; no other input is read\n"
+	<< "-benchingest time each -ingest mode on the input and check they load the same counts\n"
+	<< "-hashstats report probe lengths of the kmer hash functions on the input\n"
 	<< "\nOutput:\n"
-	<< "<kmer> <library count> <goodness-of-fit for library set>\n"
+	<< "<kmer> <library count> <goodness-of-fit for library set> [<p-value for library set> <q-value for library set>]\n"
 	<< "\n";
 }
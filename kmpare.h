@@ -7,14 +7,80 @@
 
 #include <vector>
 #include <fstream>
+#include <string>
+#include "kmer.h"
 
 // version
 const char * version = "0.1.1"; // 7 December 2014
 
+const int maxPartBits = 16; // at most 2^16 out-of-core partitions
+
+// optional run settings
+struct runOptions
+{
+	runOptions ()
+		: hashstats(false),
+		  benchingest(false),
+		  ingest("hash"),
+		  nthreads(1),
+		  shardbits(-1),
+		  maxmemory(0),
+		  stream(false),
+		  binary(false),
+		  countbytes(0),
+		  statbytes(8),
+		  tablebytes(0),
+		  sparse(-1),
+		  presize(true),
+		  mincount(0),
+		  minlibs(0),
+		  canonical(false),
+		  pvalues(false),
+		  top(0),
+		  minstat(0),
+		  useminstat(false),
+		  serve(false)
+	{ }
+	bool hashstats; // report probe-length statistics for each kmer hash function
+	bool benchingest; // time every ingest mode on the input before the run
+	std::string ingest; // how Jellyfish files are loaded: "hash", "merge", "shard", or "atomic"
+	unsigned int nthreads; // number of worker threads
+	int shardbits; // log2 of the number of table shards for "shard" ingest (-1 picks from nthreads)
+	size_t maxmemory; // memory budget in bytes for the kmer table and statistics (0 for no limit)
+	bool stream; // inputs are sorted by kmer and are merged without a kmer table
+	bool binary; // write results in the binary column-blocked format of resultFile.h
+	unsigned int countbytes; // bytes per count in binary output (0 picks the fewest that fit)
+	unsigned int statbytes; // bytes per statistic in binary output, 4 (float) or 8 (double)
+	unsigned int tablebytes; // bytes per count in the kmer table (0 picks from a sample of the input)
+	int sparse; // sparse count rows for merge ingest: 1 always, 0 never, -1 when they at least halve the table
+	bool presize; // size the kmer table from a HyperLogLog pass over the input before hash, shard, or atomic ingest
+	unsigned int mincount; // drop kmers whose counts over all libraries sum to less than this
+	unsigned int minlibs; // drop kmers found in fewer libraries than this
+	bool canonical; // fold each kmer with its reverse complement
+	bool pvalues; // write p-values and q-values after the statistics
+	size_t top; // write only kmers among the top highest statistics of some set (0 writes all)
+	double minstat; // write only kmers with a statistic of at least this for some set, if useminstat
+	bool useminstat;
+	std::string totext; // binary result file to convert to text instead of analyzing input
+	std::string saveindex; // file to save the kmer table to once the input is loaded
+	std::string loadindex; // file of a saved kmer table to analyze instead of the input
+	bool serve; // answer kmer queries instead of writing the analysis
+	std::string socket; // Unix socket to serve queries on (standard input and output if empty)
+	std::string targets; // file of the only kmers to load (all kmers if empty)
+};
+
 // functions
-bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::vector< std::vector<unsigned int> >* cmpindex, std::string& ofname);
+bool parseArgs (int argc, char** argv, std::vector<std::string>* ifname, std::vector< std::vector<unsigned int> >* cmpindex, std::string& ofname, runOptions* opts);
 std::vector<unsigned int> parseSet (int argc, char** argv, int& pos);
-void printHeader (std::ofstream& os, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets);
+bool checkSets (const std::vector< std::vector<unsigned int> >* cmpindex, size_t nlibs);
+void printHeader (std::ostream& os, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets, bool pvalues);
+bool analyze (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, std::ofstream& os, ResultWriter* bin, unsigned int nthreads);
+bool binToText (const std::string& fname, std::ofstream& os);
+bool serve (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, const std::string& path);
+bool serveSession (kmer& jellydata, std::vector< std::vector<unsigned int> >* sets, FILE* in, int out);
+bool parseSetLine (const char* s, std::vector< std::vector<unsigned int> >* sets);
+bool sendRows (int fd, RowWriter& text);
+void benchIngest (std::vector<std::string>& infiles, const runOptions& opts);
 void info (const char* v);
 
 #endif /* KMPARE_H_ */
@@ -0,0 +1,117 @@
+/*
+ * libRuns.h
+ *
+ * per-library runs of (kmer, count) records sorted by kmer hash, and a k-way
+ * merge that walks several runs in step to produce combined count rows
+ */
+
+#ifndef LIBRUNS_H_
+#define LIBRUNS_H_
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "packedKey.h"
+
+struct KmerCount
+{
+	uint64_t hash;
+	Key key;
+	unsigned int count;
+
+	bool operator<(const KmerCount& a) const
+	{
+		if (hash != a.hash)
+			return hash < a.hash;
+		return key < a.key;
+	}
+};
+
+// hashBefore orders records by hash alone, for finding where a hash range starts in a run
+inline bool hashBefore (const KmerCount& a, const KmerCount& b)
+{
+	return a.hash < b.hash;
+}
+
+// LibRun holds one library's records after parsing
+struct LibRun
+{
+	LibRun ()
+		: merlen(0),
+		  total(0),
+		  fail(0)
+	{ }
+	std::vector<KmerCount> recs; // sorted by hash then kmer, one record per kmer
+	std::vector< std::pair<std::string, unsigned int> > ambig; // kmers with ambiguous bases
+	int merlen;
+	size_t total; // sum of counts
+	int fail;
+};
+
+// RunMerger merges the [begin, end) slices of several runs in hash order
+class RunMerger
+{
+public:
+	RunMerger (unsigned int nruns)
+		: _cur(nruns, (const KmerCount*)0),
+		  _end(nruns, (const KmerCount*)0)
+	{
+		_heap.reserve(nruns);
+	}
+
+	void add (unsigned int run, const KmerCount* begin, const KmerCount* end)
+	{
+		_cur[run] = begin;
+		_end[run] = end;
+		if (begin != end)
+		{
+			_heap.push_back(run);
+			std::push_heap(_heap.begin(), _heap.end(), Later(this));
+		}
+	}
+
+	// next sets the next kmer in hash order and fills its count row, returns false when all runs are exhausted
+	bool next (uint64_t& hash, Key& key, unsigned int counts [])
+	{
+		if (_heap.empty())
+			return false;
+		unsigned int run = _heap.front();
+		hash = _cur[run]->hash;
+		key = _cur[run]->key;
+		if (counts)
+			memset(counts, 0, _cur.size() * sizeof(unsigned int));
+		while (!_heap.empty() && _cur[_heap.front()]->hash == hash && _cur[_heap.front()]->key == key)
+		{
+			run = _heap.front();
+			std::pop_heap(_heap.begin(), _heap.end(), Later(this));
+			_heap.pop_back();
+			if (counts)
+				counts[run] = _cur[run]->count;
+			if (++_cur[run] != _end[run])
+			{
+				_heap.push_back(run);
+				std::push_heap(_heap.begin(), _heap.end(), Later(this));
+			}
+		}
+		return true;
+	}
+
+private:
+	struct Later
+	{
+		Later (const RunMerger* m)
+			: merger(m)
+		{ }
+		bool operator() (unsigned int a, unsigned int b) const
+		{
+			return *merger->_cur[b] < *merger->_cur[a];
+		}
+		const RunMerger* merger;
+	};
+	std::vector<const KmerCount*> _cur;
+	std::vector<const KmerCount*> _end;
+	std::vector<unsigned int> _heap; // min-heap of runs keyed on their current record
+};
+
+#endif /* LIBRUNS_H_ */
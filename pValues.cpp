@@ -0,0 +1,164 @@
+/*
+ * pValues.cpp
+ */
+
+#include "pValues.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <thread>
+
+const int gammaIterations = 500; // terms of the series or continued fraction before giving up
+const double gammaEpsilon = 1e-15; // relative size of the last term kept
+
+// gammaUpper returns the regularized upper incomplete gamma function Q(a, x) given lgamma(a), from the series for P(a, x)
+// below x = a + 1 and from Lentz's continued fraction above it (Numerical Recipes 6.2)
+static double gammaUpper (double a, double x, double lga)
+{
+	if (x <= 0)
+		return 1.0;
+	double front = exp(a * log(x) - x - lga);
+	int n = 0;
+	if (x < a + 1)
+	{
+		double term = 1.0 / a;
+		double sum = term;
+		for (n = 1; n < gammaIterations && fabs(term) >= fabs(sum) * gammaEpsilon; ++n)
+		{
+			term *= x / (a + n);
+			sum += term;
+		}
+		return std::max(0.0, 1.0 - sum * front);
+	}
+	const double tiny = std::numeric_limits<double>::min() / gammaEpsilon;
+	double b = x + 1 - a;
+	double c = 1.0 / tiny;
+	double d = 1.0 / b;
+	double h = d;
+	for (n = 1; n < gammaIterations; ++n)
+	{
+		double an = -n * (n - a);
+		b += 2;
+		d = an * d + b;
+		if (fabs(d) < tiny)
+			d = tiny;
+		c = b + an / c;
+		if (fabs(c) < tiny)
+			c = tiny;
+		d = 1.0 / d;
+		double delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1.0) < gammaEpsilon)
+			break;
+	}
+	return front * h;
+}
+
+// chiSquareUpper returns the probability that a chi-square variable with df degrees of freedom is at least stat;
+// an infinite statistic (a library set with zero expectation) gets 0 and a set of one library, with df 0, gets 1
+double chiSquareUpper (double stat, unsigned int df)
+{
+	if (df == 0)
+		return 1.0;
+	if (stat == std::numeric_limits<double>::infinity())
+		return 0.0;
+	return gammaUpper(0.5 * df, 0.5 * stat, lgamma(0.5 * df));
+}
+
+// chiSquareUpper sets p[r] for r < n to the p-value of stat[r], sharing lgamma across the batch
+void chiSquareUpper (const double stat [], size_t n, unsigned int df, double p [])
+{
+	double a = 0.5 * df;
+	double lga = df ? lgamma(a) : 0.0;
+	for (size_t r = 0; r < n; ++r)
+	{
+		if (df == 0)
+			p[r] = 1.0;
+		else if (stat[r] == std::numeric_limits<double>::infinity())
+			p[r] = 0.0;
+		else
+			p[r] = gammaUpper(a, 0.5 * stat[r], lga);
+	}
+}
+
+QValues::QValues ()
+	: _ready(false)
+{ }
+
+// add appends n p-values of a set, leaving out NaN (a set whose libraries total 0), which is no test and would
+// break the sort; safe to call from several threads
+void QValues::add (size_t set, const double p [], size_t n)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	if (set >= _p.size())
+		_p.resize(set + 1);
+	for (size_t r = 0; r < n; ++r)
+		if (p[r] == p[r])
+			_p[set].push_back(p[r]);
+}
+
+// finish sorts each set's p-values, in nthreads pieces merged pairwise, and takes the Benjamini-Hochberg q-value of
+// the p-value of rank i out of m as the least p * m / j over the p-values of rank j >= i, capped at 1
+void QValues::finish (unsigned int nthreads)
+{
+	size_t i = 0;
+	size_t step = 0;
+	std::vector<std::thread> workers;
+	_q.resize(_p.size());
+	for (size_t j = 0; j < _p.size(); ++j)
+	{
+		std::vector<double>& p = _p[j];
+		size_t m = p.size();
+		size_t nparts = std::max(1U, std::min(nthreads, static_cast<unsigned int>(m / 65536 + 1)));
+		std::vector<size_t> cut(nparts + 1);
+		for (i = 0; i <= nparts; ++i)
+			cut[i] = m * i / nparts;
+		for (i = 0; i < nparts; ++i)
+			workers.push_back(std::thread([&p, &cut, i] { std::sort(p.begin() + cut[i], p.begin() + cut[i + 1]); }));
+		for (i = 0; i < workers.size(); ++i)
+			workers[i].join();
+		workers.clear();
+		for (step = 1; step < nparts; step *= 2)
+		{
+			for (i = 0; i + step < nparts; i += 2 * step)
+				workers.push_back(std::thread([&p, &cut, i, step, nparts] {
+					std::inplace_merge(p.begin() + cut[i], p.begin() + cut[i + step], p.begin() + cut[std::min(i + 2 * step, nparts)]); }));
+			for (i = 0; i < workers.size(); ++i)
+				workers[i].join();
+			workers.clear();
+		}
+
+		std::vector<double>& q = _q[j];
+		q.resize(m);
+		double least = 1.0;
+		for (i = m; i > 0; --i)
+		{
+			least = std::min(least, p[i - 1] * m / i);
+			q[i - 1] = least;
+		}
+	}
+	_ready = true;
+}
+
+bool QValues::ready () const
+{
+	return _ready;
+}
+
+// lookup returns the q-value of p, which must be one of the p-values added for the set; tied p-values share the
+// q-value of the last of them; a NaN p-value has a NaN q-value
+double QValues::lookup (size_t set, double p) const
+{
+	if (p != p)
+		return p;
+	const std::vector<double>& sorted = _p[set];
+	size_t i = std::lower_bound(sorted.begin(), sorted.end(), p) - sorted.begin();
+	return i < sorted.size() ? _q[set][i] : 1.0;
+}
+
+void QValues::clear ()
+{
+	_p.clear();
+	_q.clear();
+	_ready = false;
+}
@@ -0,0 +1,36 @@
+/*
+ * pValues.h
+ *
+ * chi-square p-values of goodness-of-fit statistics, and Benjamini-Hochberg q-values
+ * over every kmer scored against a library set
+ */
+
+#ifndef PVALUES_H_
+#define PVALUES_H_
+
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+double chiSquareUpper (double stat, unsigned int df);
+void chiSquareUpper (const double stat [], size_t n, unsigned int df, double p []);
+
+// QValues gathers the p-values of all kmers for each library set from any number of threads; once finished it
+// gives the q-value of any of those p-values, the smallest false discovery rate at which that kmer is called
+class QValues
+{
+public:
+	QValues ();
+	void add (size_t set, const double p [], size_t n);
+	void finish (unsigned int nthreads);
+	bool ready () const;
+	double lookup (size_t set, double p) const;
+	void clear ();
+private:
+	std::vector< std::vector<double> > _p; // p-values of each set, sorted once finished
+	std::vector< std::vector<double> > _q; // q-value of each sorted p-value
+	std::mutex _lock; // guards _p while threads add to it
+	bool _ready;
+};
+
+#endif /* PVALUES_H_ */
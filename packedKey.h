@@ -0,0 +1,179 @@
+/*
+ * packedKey.h
+ */
+
+#ifndef PACKEDKEY_H_
+#define PACKEDKEY_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+// number of 64-bit words per packed kmer (build with -DKMER_WORDS=n for kmers longer than 32 bases)
+#ifndef KMER_WORDS
+#define KMER_WORDS 1
+#endif
+
+const int maxMerLength = 32 * KMER_WORDS; // longest kmer a Key can hold
+const uint64_t ambigFlag = 0x8000000000000000ULL; // set in id[0] of keys standing in for kmers with ambiguous bases
+
+// Key holds a kmer packed at 2 bits per base (A=0, C=1, G=2, T=3)
+// the kmer is right-aligned across the words with id[0] most significant, so
+// comparing words in order gives the lexicographic order of the sequences
+struct Key
+{
+	uint64_t id[KMER_WORDS];
+
+	bool operator==(const Key& a) const
+	{
+		for (int i = 0; i < KMER_WORDS; ++i)
+		{
+			if (id[i] != a.id[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool operator!=(const Key& a) const
+	{
+		return !(*this == a);
+	}
+
+	bool operator<(const Key& a) const
+	{
+		for (int i = 0; i < KMER_WORDS; ++i)
+		{
+			if (id[i] != a.id[i])
+				return id[i] < a.id[i];
+		}
+		return false;
+	}
+};
+
+// baseCode maps ASCII nucleotides to their 2-bit code, any other character maps to 4
+struct BaseCode
+{
+	unsigned char code [256];
+
+	BaseCode ()
+	{
+		for (int i = 0; i < 256; ++i)
+			code[i] = 4;
+		code['A'] = code['a'] = 0;
+		code['C'] = code['c'] = 1;
+		code['G'] = code['g'] = 2;
+		code['T'] = code['t'] = 3;
+	}
+};
+
+static const BaseCode baseCode;
+static const char codeBase [4] = {'A', 'C', 'G', 'T'};
+
+// ambigSpace returns whether a kmer of length merlen leaves the top bit free for ambigFlag
+inline bool ambigSpace (int merlen)
+{
+	return 2 * merlen < 64 * KMER_WORDS;
+}
+
+// packSeq packs merlen bases of s into key, returns false if s contains a base other than A, C, G, or T
+inline bool packSeq (const char* s, int merlen, Key& key)
+{
+	for (int w = 0; w < KMER_WORDS; ++w)
+		key.id[w] = 0;
+	unsigned char invalid = 0;
+	int w = KMER_WORDS - 1 - (merlen - 1) / 32; // word holding the first base
+	int inword = (merlen - 1) % 32 + 1; // number of bases in the current word
+	uint64_t word = 0;
+	unsigned char c = 0;
+	for (int i = 0; i < merlen; ++i)
+	{
+		c = baseCode.code[static_cast<unsigned char>(s[i])];
+		invalid |= c;
+		word = (word << 2) | (c & 3);
+		if (--inword == 0)
+		{
+			key.id[w++] = word;
+			word = 0;
+			inword = 32;
+		}
+	}
+	return !(invalid & 4);
+}
+
+// reverseBases reverses the order of the 32 two-bit bases in a word
+inline uint64_t reverseBases (uint64_t x)
+{
+	x = __builtin_bswap64(x);
+	x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+	return ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+}
+
+// revComp sets rc to the reverse complement of the merlen bases held in key: the complement of a base is 3 minus
+// its code, so every word is inverted and has its bases reversed, the words are taken in reverse order, and the
+// result is shifted back down to be right-aligned
+inline void revComp (const Key& key, int merlen, Key& rc)
+{
+	Key r;
+	int w = 0;
+	for (w = 0; w < KMER_WORDS; ++w)
+		r.id[w] = reverseBases(~key.id[KMER_WORDS - 1 - w]);
+	int shift = 64 * KMER_WORDS - 2 * merlen;
+	int q = shift / 64;
+	int b = shift % 64;
+	for (w = KMER_WORDS - 1; w >= 0; --w)
+	{
+		uint64_t lo = w - q >= 0 ? r.id[w - q] : 0;
+		uint64_t hi = w - q - 1 >= 0 ? r.id[w - q - 1] : 0;
+		rc.id[w] = b ? lo >> b | hi << (64 - b) : lo;
+	}
+}
+
+// canonicalKey replaces key by its reverse complement if that sorts first, returning whether it did
+inline bool canonicalKey (Key& key, int merlen)
+{
+	Key rc;
+	revComp(key, merlen, rc);
+	if (!(rc < key))
+		return false;
+	key = rc;
+	return true;
+}
+
+// canonicalSeq does the same for a kmer given as upper-case text, which may hold ambiguous bases; an IUPAC code
+// complements to the code for the complements of its bases (N to N)
+inline bool canonicalSeq (char* s, int merlen)
+{
+	static const char complement [] = "TVGHEFCDIJMLKNOPQYSAUBWXRZ";
+	int i = 0;
+	int cmp = 0;
+	for (i = 0; i < merlen && cmp == 0; ++i)
+	{
+		char c = s[merlen - 1 - i];
+		char r = c >= 'A' && c <= 'Z' ? complement[c - 'A'] : c;
+		cmp = (r > s[i]) - (r < s[i]);
+	}
+	if (cmp >= 0)
+		return false;
+	for (i = 0; i < merlen / 2; ++i)
+	{
+		char c = s[i];
+		s[i] = s[merlen - 1 - i];
+		s[merlen - 1 - i] = c;
+	}
+	for (i = 0; i < merlen; ++i)
+		if (s[i] >= 'A' && s[i] <= 'Z')
+			s[i] = complement[s[i] - 'A'];
+	return true;
+}
+
+// unpackSeq writes the merlen bases held in key to s
+inline void unpackSeq (const Key& key, int merlen, char* s)
+{
+	int bit = 0;
+	for (int i = merlen - 1; i >= 0; --i)
+	{
+		s[i] = codeBase[(key.id[KMER_WORDS - 1 - bit / 64] >> (bit % 64)) & 3];
+		bit += 2;
+	}
+}
+
+#endif /* PACKEDKEY_H_ */
@@ -0,0 +1,388 @@
+/*
+ * resultFile.cpp
+ */
+
+#include "resultFile.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// padded returns n rounded up to a multiple of 8
+static size_t padded (size_t n)
+{
+	return (n + 7) & ~static_cast<size_t>(7);
+}
+
+ResultWriter::ResultWriter (std::ofstream& os, unsigned int countbytes, unsigned int statbytes, bool pvalues)
+	: _os(os),
+	  _rows(0),
+	  _started(false),
+	  _closed(false),
+	  _fail(false)
+{
+	memset(&_head, 0, sizeof(_head));
+	memcpy(_head.magic, resultMagic, sizeof(resultMagic));
+	_head.countbytes = countbytes;
+	_head.statbytes = statbytes;
+	_head.blockrows = resultBlockRows;
+	_head.pvalues = pvalues;
+}
+
+ResultWriter::~ResultWriter ()
+{
+	close();
+}
+
+// start writes the header; countbytes replaces the width given to the constructor if that was 0
+bool ResultWriter::start (int merlen, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets, unsigned int countbytes)
+{
+	_head.merlen = merlen;
+	_head.nlibs = nlibs;
+	_head.nsets = sets->size();
+	if (_head.countbytes == 0)
+		_head.countbytes = countbytes;
+	_os.write(reinterpret_cast<const char*>(&_head), sizeof(_head));
+	size_t pos = sizeof(_head);
+	for (size_t j = 0; j < sets->size(); ++j)
+	{
+		uint32_t n = (*sets)[j].size();
+		_os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			uint32_t lib = (*sets)[j][i];
+			_os.write(reinterpret_cast<const char*>(&lib), sizeof(lib));
+		}
+		pos += sizeof(n) * (n + 1);
+	}
+	_head.dataoffset = (pos + 63) & ~static_cast<size_t>(63);
+	for (; pos < _head.dataoffset; ++pos)
+		_os.put('\0');
+
+	_width.clear();
+	_width.push_back((merlen + 3) / 4);
+	_width.insert(_width.end(), nlibs, _head.countbytes);
+	_width.insert(_width.end(), sets->size() * (_head.pvalues ? 3 : 1), _head.statbytes);
+	_cols.resize(_width.size());
+	for (size_t c = 0; c < _cols.size(); ++c)
+		_cols[c].assign(padded(static_cast<size_t>(_head.blockrows) * _width[c]), 0);
+	_started = true;
+	_fail = _os.fail();
+	return !_fail;
+}
+
+bool ResultWriter::started () const
+{
+	return _started;
+}
+
+unsigned int ResultWriter::countBytes () const
+{
+	return _head.countbytes;
+}
+
+// add appends a row; ambig is the kmer's sequence if it has ambiguous bases and 0 otherwise; stats holds a value
+// per set, followed with p-values by a p-value and then a q-value per set
+bool ResultWriter::add (const Key& key, const char* ambig, const unsigned int counts [], const double stats [])
+{
+	if (_fail)
+		return false;
+	size_t c = 0;
+	unsigned int i = 0;
+
+	// packed kmer
+	unsigned char* kbuf = reinterpret_cast<unsigned char*>(&_cols[0][_rows * _width[0]]);
+	memset(kbuf, 0, _width[0]);
+	if (ambig)
+	{
+		uint64_t row = _head.nrows;
+		_ambig.insert(_ambig.end(), reinterpret_cast<const char*>(&row), reinterpret_cast<const char*>(&row) + sizeof(row));
+		_ambig.insert(_ambig.end(), ambig, ambig + _head.merlen);
+		++_head.nambig;
+	}
+	else
+	{
+		for (i = 0; i < _head.merlen; ++i)
+		{
+			int bit = 2 * (_head.merlen - 1 - i);
+			unsigned int code = (key.id[KMER_WORDS - 1 - bit / 64] >> (bit % 64)) & 3;
+			kbuf[i / 4] |= code << (6 - 2 * (i % 4));
+		}
+	}
+
+	// counts
+	for (i = 0, c = 1; i < _head.nlibs; ++i, ++c)
+	{
+		char* dst = &_cols[c][_rows * _head.countbytes];
+		if (_head.countbytes == 4)
+		{
+			uint32_t v = counts[i];
+			memcpy(dst, &v, 4);
+		}
+		else if (_head.countbytes == 2 && counts[i] <= 0xffff)
+		{
+			uint16_t v = counts[i];
+			memcpy(dst, &v, 2);
+		}
+		else if (_head.countbytes == 1 && counts[i] <= 0xff)
+		{
+			uint8_t v = counts[i];
+			memcpy(dst, &v, 1);
+		}
+		else
+		{
+			fprintf(stderr, "Count %u does not fit in %u bytes of binary output (see -countbytes)\n", counts[i], _head.countbytes);
+			_fail = true;
+			return false;
+		}
+	}
+
+	// statistics
+	for (i = 0; i < _head.nsets * (_head.pvalues ? 3 : 1); ++i, ++c)
+	{
+		char* dst = &_cols[c][_rows * _head.statbytes];
+		if (_head.statbytes == 4)
+		{
+			float v = stats[i];
+			memcpy(dst, &v, 4);
+		}
+		else
+			memcpy(dst, &stats[i], 8);
+	}
+
+	++_head.nrows;
+	if (++_rows == _head.blockrows)
+		flushBlock();
+	return true;
+}
+
+// flushBlock writes the rows of the current block column by column
+void ResultWriter::flushBlock ()
+{
+	for (size_t c = 0; c < _cols.size(); ++c)
+		_os.write(&_cols[c][0], padded(static_cast<size_t>(_rows) * _width[c]));
+	_rows = 0;
+	if (_os.fail())
+		_fail = true;
+}
+
+// close writes the last block and the ambiguous kmers, then fills in the header
+bool ResultWriter::close ()
+{
+	if (!_started || _closed)
+		return !_fail;
+	_closed = true;
+	if (_rows > 0)
+		flushBlock();
+	_head.ambigoffset = _os.tellp();
+	if (!_ambig.empty())
+		_os.write(&_ambig[0], _ambig.size());
+	_os.seekp(0);
+	_os.write(reinterpret_cast<const char*>(&_head), sizeof(_head));
+	_os.seekp(0, std::ios::end);
+	_os.flush();
+	if (_os.fail())
+		_fail = true;
+	return !_fail;
+}
+
+bool ResultWriter::fail () const
+{
+	return _fail;
+}
+
+ResultReader::ResultReader ()
+	: _data(0),
+	  _len(0),
+	  _blockbytes(0)
+{
+	memset(&_head, 0, sizeof(_head));
+}
+
+ResultReader::~ResultReader ()
+{
+	close();
+}
+
+// open maps fname and checks that its header describes a complete result file
+bool ResultReader::open (const char* fname)
+{
+	close();
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not open file: %s\n", fname);
+		return false;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == 0 && static_cast<size_t>(sb.st_size) >= sizeof(ResultHeader))
+	{
+		void* addr = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED)
+		{
+			_data = static_cast<char*>(addr);
+			_len = sb.st_size;
+		}
+	}
+	::close(fd);
+	if (_data == 0)
+	{
+		fprintf(stderr, "%s is not a kmpare binary result file\n", fname);
+		return false;
+	}
+	memcpy(&_head, _data, sizeof(_head));
+	if (memcmp(_head.magic, resultMagic, sizeof(resultMagic)) != 0 || _head.blockrows == 0 || _head.merlen == 0
+		|| (_head.countbytes != 1 && _head.countbytes != 2 && _head.countbytes != 4) || (_head.statbytes != 4 && _head.statbytes != 8) || _head.pvalues > 1
+		|| _head.ambigoffset + _head.nambig * (sizeof(uint64_t) + _head.merlen) > _len)
+	{
+		fprintf(stderr, "%s is not a kmpare binary result file or is incomplete\n", fname);
+		close();
+		return false;
+	}
+
+	size_t pos = sizeof(_head);
+	uint32_t n = 0;
+	_sets.resize(_head.nsets);
+	for (uint32_t j = 0; j < _head.nsets && pos + sizeof(n) <= _len; ++j)
+	{
+		memcpy(&n, _data + pos, sizeof(n));
+		pos += sizeof(n);
+		_sets[j].resize(n);
+		if (n > 0 && pos + n * sizeof(uint32_t) <= _len)
+			memcpy(_sets[j].data(), _data + pos, n * sizeof(uint32_t));
+		pos += n * sizeof(uint32_t);
+	}
+
+	_width.clear();
+	_width.push_back((_head.merlen + 3) / 4);
+	_width.insert(_width.end(), _head.nlibs, _head.countbytes);
+	_width.insert(_width.end(), _head.nsets * (_head.pvalues ? 3 : 1), _head.statbytes);
+	_blockbytes = columnOffset(_head.blockrows, _width.size());
+	if (pos > _head.dataoffset || _head.dataoffset + (nblocks() ? (nblocks() - 1) * _blockbytes
+		+ columnOffset(blockRows(nblocks() - 1), _width.size()) : 0) > _head.ambigoffset)
+	{
+		fprintf(stderr, "%s is not a kmpare binary result file or is incomplete\n", fname);
+		close();
+		return false;
+	}
+
+	const char* rec = _data + _head.ambigoffset;
+	uint64_t row = 0;
+	for (uint64_t i = 0; i < _head.nambig; ++i)
+	{
+		memcpy(&row, rec, sizeof(row));
+		_ambig.push_back(std::make_pair(row, rec + sizeof(row)));
+		rec += sizeof(row) + _head.merlen;
+	}
+	return true;
+}
+
+void ResultReader::close ()
+{
+	if (_data)
+		munmap(_data, _len);
+	_data = 0;
+	_len = 0;
+	_sets.clear();
+	_ambig.clear();
+}
+
+const ResultHeader& ResultReader::header () const
+{
+	return _head;
+}
+
+const std::vector< std::vector<unsigned int> >& ResultReader::sets () const
+{
+	return _sets;
+}
+
+uint64_t ResultReader::nblocks () const
+{
+	return (_head.nrows + _head.blockrows - 1) / _head.blockrows;
+}
+
+uint64_t ResultReader::blockRows (uint64_t block) const
+{
+	return std::min(static_cast<uint64_t>(_head.blockrows), _head.nrows - block * _head.blockrows);
+}
+
+// column returns the start of a column of a block: 0 is the kmers, then one per library, then one per library set,
+// then with p-values one per set for them and one per set for q-values
+const char* ResultReader::column (uint64_t block, unsigned int col) const
+{
+	return _data + _head.dataoffset + block * _blockbytes + columnOffset(blockRows(block), col);
+}
+
+// columnOffset is where column col starts in a block of rows rows
+size_t ResultReader::columnOffset (uint64_t rows, unsigned int col) const
+{
+	size_t off = 0;
+	for (unsigned int c = 0; c < col; ++c)
+		off += padded(rows * _width[c]);
+	return off;
+}
+
+// kmer writes the merlen bases of row to s
+void ResultReader::kmer (uint64_t row, char* s) const
+{
+	std::vector<std::pair<uint64_t, const char*> >::const_iterator it =
+		std::lower_bound(_ambig.begin(), _ambig.end(), std::make_pair(row, static_cast<const char*>(0)));
+	if (it != _ambig.end() && it->first == row)
+	{
+		memcpy(s, it->second, _head.merlen);
+		return;
+	}
+	const unsigned char* k = reinterpret_cast<const unsigned char*>(column(row / _head.blockrows, 0)) + (row % _head.blockrows) * _width[0];
+	for (uint32_t i = 0; i < _head.merlen; ++i)
+		s[i] = codeBase[(k[i / 4] >> (6 - 2 * (i % 4))) & 3];
+}
+
+unsigned int ResultReader::count (uint64_t row, unsigned int lib) const
+{
+	const char* p = column(row / _head.blockrows, 1 + lib) + (row % _head.blockrows) * _head.countbytes;
+	if (_head.countbytes == 1)
+		return *reinterpret_cast<const uint8_t*>(p);
+	if (_head.countbytes == 2)
+	{
+		uint16_t v;
+		memcpy(&v, p, 2);
+		return v;
+	}
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+double ResultReader::stat (uint64_t row, unsigned int set) const
+{
+	return statColumn(row, 1 + _head.nlibs + set);
+}
+
+// pvalue and qvalue return the p-value and q-value of a row for a set, or 1 if the file has none
+double ResultReader::pvalue (uint64_t row, unsigned int set) const
+{
+	return _head.pvalues ? statColumn(row, 1 + _head.nlibs + _head.nsets + set) : 1.0;
+}
+
+double ResultReader::qvalue (uint64_t row, unsigned int set) const
+{
+	return _head.pvalues ? statColumn(row, 1 + _head.nlibs + 2 * _head.nsets + set) : 1.0;
+}
+
+double ResultReader::statColumn (uint64_t row, unsigned int col) const
+{
+	const char* p = column(row / _head.blockrows, col) + (row % _head.blockrows) * _head.statbytes;
+	if (_head.statbytes == 4)
+	{
+		float v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+	double v;
+	memcpy(&v, p, 8);
+	return v;
+}
@@ -0,0 +1,104 @@
+/*
+ * resultFile.h
+ *
+ * binary, column-blocked kmpare results
+ *
+ * layout (native byte order):
+ *   ResultHeader
+ *   for each library set: uint32 size, then size uint32 library indices (0-based)
+ *   blocks of blockrows rows (the last may be shorter) starting at dataoffset; a block holds
+ *     one column of packed kmers ((merlen + 3) / 4 bytes, first base in the top bits),
+ *     one column of countbytes-wide counts per library, and one column of statbytes-wide
+ *     goodness-of-fit values per library set, followed if pvalues is 1 by a column of
+ *     p-values per set and a column of q-values per set, each column padded to 8 bytes
+ *   at ambigoffset, nambig records of uint64 row followed by merlen bytes of sequence for
+ *     kmers with ambiguous bases (their packed kmer is zero)
+ * every full block has the same size, so a reader can find any column of any block from
+ * the header alone and map just the columns it needs
+ */
+
+#ifndef RESULTFILE_H_
+#define RESULTFILE_H_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "packedKey.h"
+
+const char resultMagic [8] = {'K', 'M', 'P', 'R', 'E', 'S', '2', '\0'};
+const uint32_t resultBlockRows = 1 << 16; // rows per column block
+
+struct ResultHeader
+{
+	char magic [8];
+	uint32_t merlen;
+	uint32_t nlibs;
+	uint32_t nsets;
+	uint32_t countbytes; // 1, 2, or 4
+	uint32_t statbytes; // 4 (float) or 8 (double)
+	uint32_t blockrows;
+	uint32_t pvalues; // 1 if each set has p-value and q-value columns
+	uint32_t reserved;
+	uint64_t nrows;
+	uint64_t nambig;
+	uint64_t ambigoffset;
+	uint64_t dataoffset;
+};
+
+// ResultWriter buffers one block of rows at a time and writes it to the stream as columns
+class ResultWriter
+{
+public:
+	ResultWriter (std::ofstream& os, unsigned int countbytes, unsigned int statbytes, bool pvalues = false);
+	~ResultWriter ();
+	bool start (int merlen, unsigned int nlibs, const std::vector< std::vector<unsigned int> >* sets, unsigned int countbytes);
+	bool started () const;
+	unsigned int countBytes () const;
+	bool add (const Key& key, const char* ambig, const unsigned int counts [], const double stats []);
+	bool close ();
+	bool fail () const;
+private:
+	void flushBlock ();
+	std::ofstream& _os;
+	ResultHeader _head;
+	std::vector< std::vector<char> > _cols; // current block, one buffer per column
+	std::vector<unsigned int> _width; // bytes per row of each column
+	uint32_t _rows; // rows in the current block
+	std::vector<char> _ambig; // ambiguous kmer records, written after the last block
+	bool _started;
+	bool _closed;
+	bool _fail;
+};
+
+// ResultReader maps a result file and gives row-wise or column-wise access to it
+class ResultReader
+{
+public:
+	ResultReader ();
+	~ResultReader ();
+	bool open (const char* fname);
+	void close ();
+	const ResultHeader& header () const;
+	const std::vector< std::vector<unsigned int> >& sets () const;
+	const char* column (uint64_t block, unsigned int col) const;
+	uint64_t blockRows (uint64_t block) const;
+	uint64_t nblocks () const;
+	void kmer (uint64_t row, char* s) const;
+	unsigned int count (uint64_t row, unsigned int lib) const;
+	double stat (uint64_t row, unsigned int set) const;
+	double pvalue (uint64_t row, unsigned int set) const;
+	double qvalue (uint64_t row, unsigned int set) const;
+private:
+	double statColumn (uint64_t row, unsigned int col) const;
+	size_t columnOffset (uint64_t rows, unsigned int col) const;
+	char* _data;
+	size_t _len;
+	ResultHeader _head;
+	std::vector< std::vector<unsigned int> > _sets;
+	std::vector<unsigned int> _width; // bytes per row of each column
+	size_t _blockbytes; // size of a full block
+	std::vector<std::pair<uint64_t, const char*> > _ambig; // row and sequence of kmers with ambiguous bases, by row
+};
+
+#endif /* RESULTFILE_H_ */
@@ -0,0 +1,169 @@
+/*
+ * rowWriter.h
+ *
+ * formats result rows into a large reusable buffer and hands it to the stream in
+ * big writes, or keeps them in memory for the caller to write later; counts and statistics are rendered to the same layout as
+ * std::setw(width) and std::setw(width) << std::scientific << std::setprecision(p)
+ */
+
+#ifndef ROWWRITER_H_
+#define ROWWRITER_H_
+
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+const size_t rowBufferSize = 1 << 20; // bytes formatted before they are written out
+const size_t maxField = 64; // longest field put() may be asked to render
+static const char digitPairs [201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+class RowWriter
+{
+public:
+	RowWriter (std::ostream& os, size_t bufsize = rowBufferSize)
+		: _os(&os),
+		  _buf(bufsize + maxField),
+		  _len(0),
+		  _limit(bufsize)
+	{ }
+
+	// a RowWriter without a stream grows its buffer until the caller takes the rows with data() and clear()
+	RowWriter ()
+		: _os(0),
+		  _len(0),
+		  _limit(static_cast<size_t>(-1))
+	{ }
+
+	~RowWriter ()
+	{
+		flush();
+	}
+
+	// room returns a pointer with space for n bytes, which the caller fills and then passes to advance
+	char* room (size_t n)
+	{
+		if (_len + n > _limit && _len > 0)
+			flush();
+		if (_len + n > _buf.size())
+			_buf.resize(std::max(_len + n, 2 * _buf.size()));
+		return &_buf[_len];
+	}
+
+	void advance (size_t n)
+	{
+		_len += n;
+	}
+
+	void put (char c)
+	{
+		*room(1) = c;
+		++_len;
+	}
+
+	void put (const char* s, size_t n)
+	{
+		memcpy(room(n), s, n);
+		_len += n;
+	}
+
+	// putCount writes v right aligned in a field of width characters
+	void putCount (unsigned long int v, int width)
+	{
+		char digits [24];
+		char* end = digits + sizeof(digits);
+		char* p = end;
+		while (v >= 100)
+		{
+			p -= 2;
+			memcpy(p, digitPairs + (v % 100) * 2, 2);
+			v /= 100;
+		}
+		if (v >= 10)
+		{
+			p -= 2;
+			memcpy(p, digitPairs + v * 2, 2);
+		}
+		else
+			*--p = '0' + v;
+		pad(width - (end - p));
+		put(p, end - p);
+	}
+
+	// putStat writes v in scientific notation with precision digits after the point, right aligned in a field of width characters
+	void putStat (double v, int width, int precision)
+	{
+		char text [maxField];
+		int n = 0;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+		n = std::to_chars(text, text + sizeof(text), v, std::chars_format::scientific, precision).ptr - text;
+#else
+		n = snprintf(text, sizeof(text), "%.*e", precision, v);
+#endif
+		pad(width - n);
+		put(text, n);
+	}
+
+	// flush hands the buffered bytes to the stream, if there is one
+	void flush ()
+	{
+		if (_os && _len > 0)
+		{
+			_os->write(&_buf[0], _len);
+			_len = 0;
+		}
+	}
+
+	const char* data () const
+	{
+		return _buf.empty() ? 0 : &_buf[0];
+	}
+
+	size_t size () const
+	{
+		return _len;
+	}
+
+	// clear drops the buffered bytes and releases the buffer
+	void clear ()
+	{
+		std::vector<char>().swap(_buf);
+		_len = 0;
+	}
+
+	bool fail () const
+	{
+		return _os && _os->fail();
+	}
+
+private:
+	void pad (int n)
+	{
+		if (n > 0)
+		{
+			memset(room(n), ' ', n);
+			_len += n;
+		}
+	}
+
+	std::ostream* _os; // 0 to keep rows in memory
+	std::vector<char> _buf;
+	size_t _len; // bytes formatted and not yet written
+	size_t _limit; // flush before the buffer grows past this
+};
+
+#endif /* ROWWRITER_H_ */
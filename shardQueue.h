@@ -0,0 +1,102 @@
+/*
+ * shardQueue.h
+ *
+ * bounded queue of record batches feeding one shard owner from any number of parser threads
+ */
+
+#ifndef SHARDQUEUE_H_
+#define SHARDQUEUE_H_
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "packedKey.h"
+
+struct ShardRec
+{
+	uint64_t hash;
+	Key key;
+	unsigned int lib;
+	unsigned int count;
+};
+
+// ChunkWork is a byte range of one input file handed to a parser thread
+struct ChunkWork
+{
+	unsigned int lib;
+	size_t begin;
+	size_t end;
+};
+
+// ParserState collects what a parser thread sees besides the records it routes to shards
+struct ParserState
+{
+	ParserState ()
+		: added(0),
+		  fail(0)
+	{ }
+	std::vector<size_t> total; // per-library sum of counts
+	std::vector<ShardRec> ambigcount; // lib and count of each kmer with ambiguous bases
+	std::vector<std::string> ambigseq; // their sequences
+	std::vector<ShardRec> overflow; // records that did not fit a shared table, or that one thread must add to it
+	size_t added; // kmers this thread added to a shared table
+	int fail;
+};
+
+const size_t shardBatch = 4096; // records per batch handed to a shard owner
+const size_t shardQueueDepth = 64; // batches a shard queue holds before parsers wait
+
+class ShardQueue
+{
+public:
+	ShardQueue ()
+		: _closed(false)
+	{ }
+
+	~ShardQueue ()
+	{
+		for (size_t i = 0; i < _batches.size(); ++i)
+			delete _batches[i];
+	}
+
+	// push hands a batch to the shard owner, waiting while the queue is full
+	void push (std::vector<ShardRec>* batch)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notfull.wait(lock, [this] { return _batches.size() < shardQueueDepth; });
+		_batches.push_back(batch);
+		_notempty.notify_one();
+	}
+
+	// pop returns the next batch, or 0 once the queue is closed and drained
+	std::vector<ShardRec>* pop ()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notempty.wait(lock, [this] { return !_batches.empty() || _closed; });
+		if (_batches.empty())
+			return 0;
+		std::vector<ShardRec>* batch = _batches.front();
+		_batches.pop_front();
+		_notfull.notify_one();
+		return batch;
+	}
+
+	// close tells the owner no more batches are coming
+	void close ()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_notempty.notify_all();
+	}
+
+private:
+	std::deque<std::vector<ShardRec>*> _batches;
+	std::mutex _mutex;
+	std::condition_variable _notempty;
+	std::condition_variable _notfull;
+	bool _closed;
+};
+
+#endif /* SHARDQUEUE_H_ */
@@ -0,0 +1,309 @@
+/*
+ * shardTable.h
+ *
+ * kmer table split into 2^p independent KmerTable shards keyed on the top p bits of
+ * the kmer hash; a shard can be filled by one thread without locking while other
+ * threads fill the rest, and readers can walk the shards together or one at a time
+ */
+
+#ifndef SHARDTABLE_H_
+#define SHARDTABLE_H_
+
+#include <algorithm>
+#include <vector>
+#include "kmerTable.h"
+
+template <class H>
+class ShardedTable
+{
+public:
+	class const_iterator
+	{
+	public:
+		const_iterator (const ShardedTable* table, size_t shard, const typename KmerTable<H>::const_iterator& iter)
+			: _table(table),
+			  _shard(shard),
+			  _iter(iter)
+		{
+			skip();
+		}
+		const_iterator& operator++ ()
+		{
+			++_iter;
+			skip();
+			return *this;
+		}
+		bool operator!= (const const_iterator& a) const
+		{
+			return _shard != a._shard || _iter != a._iter;
+		}
+		bool operator== (const const_iterator& a) const
+		{
+			return !(*this != a);
+		}
+		const Key& key () const
+		{
+			return _iter.key();
+		}
+		unsigned int count (unsigned int lib) const
+		{
+			return _iter.count(lib);
+		}
+		void row (unsigned int counts []) const
+		{
+			_iter.row(counts);
+		}
+		size_t shard () const
+		{
+			return _shard;
+		}
+		size_t slot () const
+		{
+			return _iter.slot();
+		}
+	private:
+		void skip ()
+		{
+			while (_shard + 1 < _table->nshards() && _iter == _table->_shards[_shard]->end())
+			{
+				++_shard;
+				_iter = _table->_shards[_shard]->begin();
+			}
+		}
+		const ShardedTable* _table;
+		size_t _shard;
+		typename KmerTable<H>::const_iterator _iter;
+	};
+
+	ShardedTable ();
+	~ShardedTable ();
+	void init (unsigned int nlibs, size_t nkeys, int shardbits = 0, int skipbits = 0, unsigned int countbytes = sizeof(unsigned int), bool sparse = false);
+	void initShard (size_t shard, size_t nkeys);
+	void layout (unsigned int nlibs, int shardbits, int skipbits, unsigned int countbytes, bool sparse);
+	void widen (const ShardedTable& from, unsigned int nlibs, size_t nkeys);
+	void compactPairs ();
+	void swap (ShardedTable& other);
+	void clear ();
+	void setCount (const Key& key, unsigned int lib, unsigned int count, bool& added);
+	void addCount (const Key& key, unsigned int lib, unsigned int count, bool& added);
+	void setRow (const Key& key, const unsigned int counts [], bool& added);
+	bool find (const Key& key, unsigned int counts []) const;
+	uint64_t hash (const Key& key) const;
+	size_t shardOf (uint64_t h) const;
+	KmerTable<H>& shard (size_t i);
+	const KmerTable<H>& shard (size_t i) const;
+	size_t nshards () const;
+	int shardBits () const;
+	int skipBits () const;
+	size_t size () const;
+	unsigned int nlibs () const;
+	unsigned int countBytes () const;
+	size_t saturated () const;
+	bool sparse () const;
+	const_iterator begin () const;
+	const_iterator end () const;
+private:
+	std::vector<KmerTable<H>*> _shards;
+	int _bits; // log2 of the number of shards
+	int _skip; // high hash bits already spent upstream (e.g. on partitioning) and ignored here
+	unsigned int _nlibs;
+	unsigned int _width; // bytes per count
+	bool _sparse; // count rows are stored as (library, count) pairs
+};
+
+template <class H> ShardedTable<H>::ShardedTable ()
+	: _bits(0),
+	  _skip(0),
+	  _nlibs(0),
+	  _width(sizeof(unsigned int)),
+	  _sparse(false)
+{
+	_shards.push_back(new KmerTable<H>);
+}
+
+template <class H> ShardedTable<H>::~ShardedTable ()
+{
+	for (size_t i = 0; i < _shards.size(); ++i)
+		delete _shards[i];
+}
+
+// init splits the table into 2^shardbits shards with room for nkeys kmers between them, storing counts in countbytes
+// or as sparse rows; shards are picked with the hash bits below the top skipbits, which every kmer stored here shares
+template <class H> void ShardedTable<H>::init (unsigned int nlibs, size_t nkeys, int shardbits, int skipbits, unsigned int countbytes, bool sparse)
+{
+	for (size_t i = 0; i < _shards.size(); ++i)
+		delete _shards[i];
+	_shards.clear();
+	_bits = shardbits;
+	_skip = skipbits;
+	_nlibs = nlibs;
+	_width = countbytes;
+	_sparse = sparse;
+	size_t n = static_cast<size_t>(1) << _bits;
+	for (size_t i = 0; i < n; ++i)
+	{
+		_shards.push_back(new KmerTable<H>);
+		_shards.back()->init(nlibs, nkeys / n, _skip + _bits, _width, _sparse);
+	}
+}
+
+// initShard resizes one empty shard to hold nkeys kmers
+template <class H> void ShardedTable<H>::initShard (size_t shard, size_t nkeys)
+{
+	_shards[shard]->init(_nlibs, nkeys, _skip + _bits, _width, _sparse);
+}
+
+// layout gives the table 2^shardbits empty shards of the shape given, to be attached to stored slots one at a time
+template <class H> void ShardedTable<H>::layout (unsigned int nlibs, int shardbits, int skipbits, unsigned int countbytes, bool sparse)
+{
+	for (size_t i = 0; i < _shards.size(); ++i)
+		delete _shards[i];
+	_shards.clear();
+	_bits = shardbits;
+	_skip = skipbits;
+	_nlibs = nlibs;
+	_width = countbytes;
+	_sparse = sparse;
+	for (size_t i = 0; i < static_cast<size_t>(1) << _bits; ++i)
+		_shards.push_back(new KmerTable<H>);
+}
+
+// widen makes this table a copy of from, shard by shard, with nlibs libraries and room for nkeys kmers (see KmerTable::widen)
+template <class H> void ShardedTable<H>::widen (const ShardedTable& from, unsigned int nlibs, size_t nkeys)
+{
+	layout(nlibs, from._bits, from._skip, from._width, from._sparse);
+	for (size_t i = 0; i < _shards.size(); ++i)
+		_shards[i]->widen(*from._shards[i], nlibs, nkeys >> _bits);
+}
+
+// compactPairs drops the sparse pairs no row uses any more, shard by shard (see KmerTable::compactPairs)
+template <class H> void ShardedTable<H>::compactPairs ()
+{
+	for (size_t i = 0; i < _shards.size(); ++i)
+		_shards[i]->compactPairs();
+}
+
+template <class H> void ShardedTable<H>::swap (ShardedTable& other)
+{
+	_shards.swap(other._shards);
+	std::swap(_bits, other._bits);
+	std::swap(_skip, other._skip);
+	std::swap(_nlibs, other._nlibs);
+	std::swap(_width, other._width);
+	std::swap(_sparse, other._sparse);
+}
+
+template <class H> void ShardedTable<H>::clear ()
+{
+	for (size_t i = 0; i < _shards.size(); ++i)
+		_shards[i]->clear();
+}
+
+// setCount sets one library's count for key, adding key with zero counts if it is not already present
+template <class H> void ShardedTable<H>::setCount (const Key& key, unsigned int lib, unsigned int count, bool& added)
+{
+	KmerTable<H>& table = *_shards[shardOf(hash(key))];
+	table.setCount(table.insert(key, added), lib, count);
+}
+
+// addCount adds to one library's count for key, adding key with zero counts if it is not already present
+template <class H> void ShardedTable<H>::addCount (const Key& key, unsigned int lib, unsigned int count, bool& added)
+{
+	KmerTable<H>& table = *_shards[shardOf(hash(key))];
+	table.addCount(table.insert(key, added), lib, count);
+}
+
+template <class H> void ShardedTable<H>::setRow (const Key& key, const unsigned int counts [], bool& added)
+{
+	KmerTable<H>& table = *_shards[shardOf(hash(key))];
+	table.setRow(table.insert(key, added), counts);
+}
+
+// find copies the count row of key to counts, returning false if key is not in the table
+template <class H> bool ShardedTable<H>::find (const Key& key, unsigned int counts []) const
+{
+	const KmerTable<H>& table = *_shards[shardOf(hash(key))];
+	size_t slot = table.find(key);
+	if (slot == KmerTable<H>::npos)
+		return false;
+	table.row(slot, counts);
+	return true;
+}
+
+template <class H> uint64_t ShardedTable<H>::hash (const Key& key) const
+{
+	return _shards[0]->hash(key);
+}
+
+template <class H> size_t ShardedTable<H>::shardOf (uint64_t h) const
+{
+	return _bits ? (h << _skip) >> (64 - _bits) : 0;
+}
+
+template <class H> KmerTable<H>& ShardedTable<H>::shard (size_t i)
+{
+	return *_shards[i];
+}
+
+template <class H> const KmerTable<H>& ShardedTable<H>::shard (size_t i) const
+{
+	return *_shards[i];
+}
+
+template <class H> size_t ShardedTable<H>::nshards () const
+{
+	return _shards.size();
+}
+
+template <class H> int ShardedTable<H>::shardBits () const
+{
+	return _bits;
+}
+
+template <class H> int ShardedTable<H>::skipBits () const
+{
+	return _skip;
+}
+
+template <class H> size_t ShardedTable<H>::size () const
+{
+	size_t n = 0;
+	for (size_t i = 0; i < _shards.size(); ++i)
+		n += _shards[i]->size();
+	return n;
+}
+
+template <class H> unsigned int ShardedTable<H>::nlibs () const
+{
+	return _nlibs;
+}
+
+template <class H> unsigned int ShardedTable<H>::countBytes () const
+{
+	return _width;
+}
+
+template <class H> size_t ShardedTable<H>::saturated () const
+{
+	size_t n = 0;
+	for (size_t i = 0; i < _shards.size(); ++i)
+		n += _shards[i]->saturated();
+	return n;
+}
+
+template <class H> bool ShardedTable<H>::sparse () const
+{
+	return _sparse;
+}
+
+template <class H> typename ShardedTable<H>::const_iterator ShardedTable<H>::begin () const
+{
+	return const_iterator(this, 0, _shards[0]->begin());
+}
+
+template <class H> typename ShardedTable<H>::const_iterator ShardedTable<H>::end () const
+{
+	return const_iterator(this, _shards.size() - 1, _shards.back()->end());
+}
+
+#endif /* SHARDTABLE_H_ */
@@ -0,0 +1,107 @@
+/*
+ * targetSet.h
+ *
+ * static set of target kmers: a sorted array of packed keys behind a blocked Bloom
+ * filter, so that a kmer off the panel is almost always turned away by one cache line
+ * of filter bits and only the rest are looked up in the array; kmers with ambiguous
+ * bases, which have no packed key of their own, are kept as text
+ */
+
+#ifndef TARGETSET_H_
+#define TARGETSET_H_
+
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+#include "packedKey.h"
+#include "kmerHash.h"
+
+const int targetHashes = 6; // filter bits set per target
+const int targetLineBits = 9; // bits of one target share a 512-bit line
+const size_t targetBitsPerKey = 16; // filter bits allotted per target, for about 0.1% false positives
+
+class TargetSet
+{
+public:
+	TargetSet ()
+		: _mask(0)
+	{ }
+
+	// init takes the targets in keys, which it sorts and leaves without repeats, and ambig, then builds the filter
+	void init (std::vector<Key>& keys, const std::vector<std::string>& ambig)
+	{
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		_keys.swap(keys);
+		std::vector<Key>(_keys).swap(_keys);
+		_ambig.clear();
+		_ambig.insert(ambig.begin(), ambig.end());
+		size_t nlines = 1;
+		while ((nlines << targetLineBits) < _keys.size() * targetBitsPerKey)
+			nlines <<= 1;
+		std::vector<uint64_t>(nlines << (targetLineBits - 6), 0).swap(_bits);
+		_mask = nlines - 1;
+		for (size_t i = 0; i < _keys.size(); ++i)
+		{
+			uint64_t h = KeyHasher()(_keys[i]);
+			uint64_t* line = &_bits[(h & _mask) << (targetLineBits - 6)];
+			uint64_t g = fmix64(h);
+			for (int j = 0; j < targetHashes; ++j, g >>= targetLineBits)
+				line[(g >> 6) & ((1 << (targetLineBits - 6)) - 1)] |= static_cast<uint64_t>(1) << (g & 63);
+		}
+	}
+
+	void clear ()
+	{
+		std::vector<Key>().swap(_keys);
+		std::vector<uint64_t>().swap(_bits);
+		_ambig.clear();
+		_mask = 0;
+	}
+
+	bool empty () const
+	{
+		return _keys.empty() && _ambig.empty();
+	}
+
+	// size is the number of distinct targets
+	size_t size () const
+	{
+		return _keys.size() + _ambig.size();
+	}
+
+	size_t bytes () const
+	{
+		return _keys.size() * sizeof(Key) + _bits.size() * sizeof(uint64_t);
+	}
+
+	// contains tells whether a packed kmer is a target, given its KeyHasher hash h
+	bool contains (const Key& key, uint64_t h) const
+	{
+		if (_keys.empty())
+			return false;
+		const uint64_t* line = &_bits[(h & _mask) << (targetLineBits - 6)];
+		uint64_t g = fmix64(h);
+		for (int j = 0; j < targetHashes; ++j, g >>= targetLineBits)
+			if (!(line[(g >> 6) & ((1 << (targetLineBits - 6)) - 1)] & (static_cast<uint64_t>(1) << (g & 63))))
+				return false;
+		return std::binary_search(_keys.begin(), _keys.end(), key);
+	}
+
+	// containsSeq tells whether a kmer with ambiguous bases, in upper case, is a target
+	bool containsSeq (const std::string& seq) const
+	{
+		return _ambig.count(seq) > 0;
+	}
+
+private:
+	std::vector<Key> _keys; // sorted
+	std::vector<uint64_t> _bits; // filter lines of 2^targetLineBits bits
+	size_t _mask; // lines - 1
+	std::unordered_set<std::string> _ambig;
+};
+
+#endif /* TARGETSET_H_ */
@@ -0,0 +1,66 @@
+#!/bin/sh
+# appendIndex.sh KMPARE
+#
+# checks -load-index with -infile: libraries appended to a saved index give the same output as loading
+# every library directly, and an index built with -min-count or -targets, or saved again from one, refuses
+# appended libraries
+# exits 0 if all of these hold
+
+kmpare=${1:?usage: appendIndex.sh KMPARE}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# four libraries of random 21-mers drawn from a shared pool, so most kmers are in several of them
+for lib in 0 1 2 3; do
+	awk -v seed=$lib 'BEGIN {
+		srand(seed + 1);
+		for (i = 0; i < 3000; ++i) {
+			srand(int(rand() * 2000) + 100); s = "";
+			for (j = 0; j < 21; ++j) s = s substr("ACGT", int(rand() * 4) + 1, 1);
+			srand(seed * 7919 + i + 1); seen[s] = int(rand() * 60) + 1;
+		}
+		for (s in seen) print s, seen[s];
+	}' > "$dir/lib$lib.txt"
+done
+
+sorted () { (head -1 "$1"; tail -n +2 "$1" | LC_ALL=C sort) > "$2"; }
+status=0
+
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/lib2.txt" "$dir/lib3.txt" -compset {1 2} {1 2 3 4} \
+	-outfile "$dir/direct" 2>/dev/null
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/lib2.txt" -compset {1 2} -outfile "$dir/first" \
+	-save-index "$dir/first.idx" 2>/dev/null
+"$kmpare" -load-index "$dir/first.idx" -infile "$dir/lib3.txt" -compset {1 2} {1 2 3 4} \
+	-outfile "$dir/appended" 2>/dev/null
+sorted "$dir/direct" "$dir/direct.s"
+sorted "$dir/appended" "$dir/appended.s"
+if ! cmp -s "$dir/direct.s" "$dir/appended.s"; then
+	echo "FAIL: appending to an index differs from loading every library"
+	status=1
+fi
+
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/lib2.txt" -compset {1 2} -outfile "$dir/filtered" \
+	-min-count 30 -save-index "$dir/filtered.idx" 2>/dev/null
+if "$kmpare" -load-index "$dir/filtered.idx" -infile "$dir/lib3.txt" -compset {1 2} {1 2 3 4} \
+	-outfile "$dir/refused" 2>/dev/null; then
+	echo "FAIL: appending to an index built with -min-count was not refused"
+	status=1
+fi
+
+awk 'NR % 4 == 0 { print $1 }' "$dir/lib0.txt" > "$dir/panel.txt"
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/lib2.txt" -compset {1 2} -outfile "$dir/panel" \
+	-targets "$dir/panel.txt" -save-index "$dir/panel.idx" 2>/dev/null
+if "$kmpare" -load-index "$dir/panel.idx" -infile "$dir/lib3.txt" -compset {1 2} {1 2 3 4} \
+	-outfile "$dir/refused2" 2>/dev/null; then
+	echo "FAIL: appending to an index built with -targets was not refused"
+	status=1
+fi
+"$kmpare" -load-index "$dir/panel.idx" -compset {1 2} -outfile "$dir/copy" -save-index "$dir/copy.idx" 2>/dev/null
+if "$kmpare" -load-index "$dir/copy.idx" -infile "$dir/lib3.txt" -compset {1 2} {1 2 3 4} \
+	-outfile "$dir/refused3" 2>/dev/null; then
+	echo "FAIL: appending to a saved copy of an index built with -targets was not refused"
+	status=1
+fi
+
+[ $status -eq 0 ] && echo "appendIndex: ok"
+exit $status
@@ -0,0 +1,44 @@
+#!/bin/sh
+# nanPValues.sh KMPARE
+#
+# checks -pvalues with a library set whose libraries all total 0: its statistics and p-values are NaN, its
+# q-values must be NaN too, and the p-values and q-values of the other set must be those of a run without it
+# exits 0 if both hold
+
+kmpare=${1:?usage: nanPValues.sh KMPARE}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# two libraries of random 21-mers from a shared pool, and two more holding the same kmers with zero counts
+for lib in 0 1; do
+	awk -v seed=$lib 'BEGIN {
+		srand(seed + 1);
+		for (i = 0; i < 3000; ++i) {
+			srand(int(rand() * 2000) + 100); s = "";
+			for (j = 0; j < 21; ++j) s = s substr("ACGT", int(rand() * 4) + 1, 1);
+			srand(seed * 7919 + i + 1); seen[s] = int(rand() * 60) + 1;
+		}
+		for (s in seen) print s, seen[s];
+	}' > "$dir/lib$lib.txt"
+	awk '{ print $1, 0 }' "$dir/lib$lib.txt" > "$dir/zero$lib.txt"
+done
+status=0
+
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/zero0.txt" "$dir/zero1.txt" -compset {1 2} {3 4} -pvalues \
+	-outfile "$dir/both" 2>/dev/null
+"$kmpare" -infile "$dir/lib0.txt" "$dir/lib1.txt" "$dir/zero0.txt" "$dir/zero1.txt" -compset {1 2} -pvalues \
+	-outfile "$dir/one" 2>/dev/null
+
+if [ -n "$(tail -n +2 "$dir/both" | cut -f 11 | grep -v nan)" ]; then
+	echo "FAIL: q-values of a set whose libraries total 0 are not NaN"
+	status=1
+fi
+cut -f 1-6,8,10 "$dir/both" | LC_ALL=C sort > "$dir/both.s"
+LC_ALL=C sort "$dir/one" > "$dir/one.s"
+if ! cmp -s "$dir/both.s" "$dir/one.s"; then
+	echo "FAIL: a set whose libraries total 0 changes the p-values or q-values of another set"
+	status=1
+fi
+
+[ $status -eq 0 ] && echo "nanPValues: ok"
+exit $status
@@ -0,0 +1,81 @@
+/*
+ * topStats.h
+ *
+ * the n highest goodness-of-fit statistics of each library set, kept in a bounded
+ * min-heap per set while kmers are scored on any number of threads; the least of
+ * them is the threshold a kmer's statistic must reach to rank in the top n
+ */
+
+#ifndef TOPSTATS_H_
+#define TOPSTATS_H_
+
+#include <vector>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+
+class TopStats
+{
+public:
+	TopStats ()
+		: _n(0)
+	{ }
+
+	// init keeps the n highest statistics of each of nsets sets, dropping any kept before
+	void init (size_t nsets, size_t n)
+	{
+		std::vector< std::vector<double> >(nsets).swap(_heap);
+		_n = n;
+	}
+
+	// add offers count statistics of a set; NaN is never kept; safe to call from several threads
+	void add (size_t set, const double v [], size_t count)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		std::vector<double>& heap = _heap[set];
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (v[i] != v[i])
+				continue;
+			if (heap.size() < _n)
+			{
+				heap.push_back(v[i]);
+				std::push_heap(heap.begin(), heap.end(), std::greater<double>());
+			}
+			else if (_n > 0 && v[i] > heap.front())
+			{
+				std::pop_heap(heap.begin(), heap.end(), std::greater<double>());
+				heap.back() = v[i];
+				std::push_heap(heap.begin(), heap.end(), std::greater<double>());
+			}
+		}
+	}
+
+	// least returns the nth highest statistic of a set, or -infinity while fewer than n have been added
+	double least (size_t set) const
+	{
+		const std::vector<double>& heap = _heap[set];
+		return heap.size() < _n || heap.empty() ? -std::numeric_limits<double>::infinity() : heap.front();
+	}
+
+	// sets returns the number of sets given to init
+	size_t sets () const
+	{
+		return _heap.size();
+	}
+
+	void clear ()
+	{
+		_heap.clear();
+		_n = 0;
+	}
+
+private:
+	std::vector< std::vector<double> > _heap; // min-heap of the highest statistics of each set
+	size_t _n;
+	std::mutex _lock; // guards _heap while threads add to it
+};
+
+#endif /* TOPSTATS_H_ */